@@ -386,9 +386,9 @@ private:
   // NOTE:    This function must be tree recursive.
   static void destroy_nodes_impl(Node *node) {
     if (node){
-      delete node;
       destroy_nodes_impl(node->left);
       destroy_nodes_impl(node->right);
+      delete node;
     }
   }
 
@@ -432,11 +432,9 @@ private:
   //       template, NOT according to the < operator. Use the "less"
   //       parameter to compare elements.
   static Node * insert_impl(Node *node, const T &item, Compare less) {
-    Node *new_node = new Node(item, nullptr, nullptr);
-
     // base case for empty and not empty
     if (!node){
-      return new_node;
+      return new Node(item, nullptr, nullptr);
     }
 
     if (less(item, node->datum)){
@@ -0,0 +1,79 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+/* BoundedQueue.hpp
+ *
+ * First-in first-out queue shared between threads, holding at most a fixed
+ * number of items. push() waits while the queue is full, so a fast producer
+ * cannot run arbitrarily far ahead of its consumers, and pop() waits while
+ * it is empty. Closing the queue wakes everyone: consumers drain what is
+ * left, then see the end.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class BoundedQueue {
+public:
+  // REQUIRES: capacity >= 1
+  // EFFECTS : Creates an empty open queue of at most capacity items.
+  explicit BoundedQueue(size_t capacity)
+    : capacity(capacity) {}
+
+  // MODIFIES: this
+  // EFFECTS : Waits until there is room, then appends item and returns
+  //           true. Returns false without appending if the queue is closed.
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this]() {
+      return closed || items.size() < capacity;
+    });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // MODIFIES: this, item
+  // EFFECTS : Waits until there is an item, then moves the oldest into item
+  //           and returns true. Returns false once the queue is closed and
+  //           empty.
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() {
+      return closed || !items.empty();
+    });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Closes the queue: later pushes fail, and pops fail once the
+  //           remaining items are taken.
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+private:
+  size_t capacity;
+  bool closed = false;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+};
+
+#endif // BOUNDEDQUEUE_HPP
@@ -0,0 +1,917 @@
+#ifndef CLASSIFIER_HPP
+#define CLASSIFIER_HPP
+/* Classifier.hpp
+ *
+ * Bernoulli naive Bayes classifier for labeled posts. Labels and words are
+ * interned to dense integer ids during training, and (label, word) counts
+ * are kept in a CountMatrix. Before predicting, finalize() turns the counts
+ * into flat ModelFile tables of log-priors and log-likelihoods, so scoring
+ * is array reads and additions. A classifier can instead load the tables
+ * of a saved model and predict from the mapped file.
+ *
+ * BasicClassifier takes the dictionary used to intern labels and words as
+ * a template parameter; Classifier is the instance picked at build time.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include "csvstream.hpp"
+#include "csvcache.hpp"
+#include "Interner.hpp"
+#include "CountMatrix.hpp"
+#include "Tokenizer.hpp"
+#include "ModelFile.hpp"
+#include "ScoreRows.hpp"
+#include "DeltaIndex.hpp"
+#include "PredictionCache.hpp"
+#include "QuantizedRows.hpp"
+#include "Map.hpp"
+
+// Number of CSV rows read at a time
+const size_t BATCH_SIZE = 4096;
+
+// Largest dense table of score rows built for prediction, in bytes
+const size_t SCORE_ROWS_LIMIT = size_t(64) << 20;
+
+// Vocabulary pruning applied when the scoring tables are built. Each
+// nonzero limit removes words, in this order; pruned words score as words
+// never seen in training. Training still counts every word, since the
+// limits rank words by their final counts, so pruning shrinks the tables
+// and saved models but not the memory used while training.
+struct Pruning {
+    // keep words contained in at least this many posts
+    int min_document_frequency = 0;
+
+    // keep the top_k words contained in the most posts
+    size_t top_k = 0;
+
+    // keep the top_mutual_information words whose presence tells the most
+    // about the label
+    size_t top_mutual_information = 0;
+
+    // EFFECTS return whether any limit is set
+    bool enabled() const{
+        return min_document_frequency > 1 || top_k > 0 ||
+            top_mutual_information > 0;
+    }
+};
+
+// How a post's label scores are added up
+enum class Scoring {
+    // word by word, the same sums as the reference implementation
+    EXACT,
+
+    // a per-label baseline plus deltas for the (label, word) pairs seen in
+    // training; the same terms in another order, see DeltaIndex
+    SPARSE,
+
+    // SPARSE, scoring only the best label once no other can overtake it
+    EARLY_EXIT,
+
+    // dense rows of log-likelihoods stored in one byte, or in two, with
+    // a bounded error per word, see QuantizedRows
+    INT8,
+    FP16
+};
+
+// Per-thread state for predicting, reused per post so that steady-state
+// prediction does not allocate
+struct PredictionScratch {
+    Tokenizer tokenizer;
+    std::vector<double> scores;
+    DeltaIndex::Work delta;
+
+    // distinct buckets of a post, when the classifier hashes its words
+    std::vector<int> buckets;
+
+    // recent predictions, when the classifier caches them
+    PredictionCache cache;
+};
+
+// Dictionary is the associative container that maps label and word
+// strings to ids, see Interner
+template <typename Dictionary>
+class BasicClassifier{
+    private:
+        // dense ids for labels and words, in order of first appearance
+        Interner<Dictionary> labels;
+        Interner<Dictionary> words;
+
+        // {{label id, word id}, number_of_posts_with_label_containing_word}
+        CountMatrix label_word_counts;
+
+        // number of posts with each label id, and containing each word id
+        std::vector<int> label_counts;
+        std::vector<int> word_counts;
+
+        int total_number_of_posts = 0;
+
+        // used by training and by compute_most_probable_tag
+        PredictionScratch scratch;
+
+        // scoring tables, built from the counts by finalize() or loaded by
+        // load_model. Reset whenever the counts change.
+        std::shared_ptr<const ModelFile> model;
+
+        // true while model was loaded and the counts above are empty
+        bool loaded = false;
+
+        // dense per-word rows of rows_model, when they fit in
+        // score_rows_limit bytes
+        ScoreRows rows;
+        std::shared_ptr<const ModelFile> rows_model;
+        size_t score_rows_limit = SCORE_ROWS_LIMIT;
+
+        // deltas of deltas_model, built for SPARSE and EARLY_EXIT scoring
+        Scoring scoring = Scoring::EXACT;
+        DeltaIndex deltas;
+        std::shared_ptr<const ModelFile> deltas_model;
+
+        // quantized rows of quantized_model, built for INT8 and FP16
+        // scoring in place of the dense rows
+        QuantizedRows quantized;
+        std::shared_ptr<const ModelFile> quantized_model;
+
+        // EFFECTS return whether scoring reads the quantized rows
+        bool quantizes() const{
+            return scoring == Scoring::INT8 || scoring == Scoring::FP16;
+        }
+
+        // REQUIRES quantizes()
+        // EFFECTS return how the quantized rows store log-likelihoods
+        QuantizedRows::Format quantized_format() const{
+            return scoring == Scoring::INT8
+                ? QuantizedRows::INT8 : QuantizedRows::FP16;
+        }
+
+        // predictions cached per PredictionScratch, 0 for none
+        size_t prediction_cache_entries = 0;
+
+        // identifies what predict computes from, so that cached
+        // predictions of an older model or scoring are not used; 0 until
+        // prepare_prediction() picks a new one
+        uint64_t version = 0;
+
+        // EFFECTS return a version no classifier in this process has had
+        static uint64_t next_version(){
+            static std::atomic<uint64_t> last{0};
+            return ++last;
+        }
+
+        // EFFECTS return the label with the highest of scores, by label
+        //         rank, and its score
+        std::pair<std::string, double> best_label(
+            const std::vector<double> &scores) const{
+            // labels in sorted order, so the first maximal label wins ties
+            int best = 0;
+            for (int label = 1; label < model->num_labels(); ++label){
+                if (scores[label] > scores[best]){
+                    best = label;
+                }
+            }
+            return std::make_pair(std::string(model->label_name(best)),
+                                  scores[best]);
+        }
+
+        // MODIFIES work
+        // EFFECTS set work.delta.words to the ids of word_names
+        void find_words(const std::vector<std::string_view> &word_names,
+                        PredictionScratch &work) const{
+            std::vector<int> &ids = work.delta.words;
+            ids.clear();
+            for (std::string_view word_name : word_names){
+                ids.push_back(model->find(word_name));
+            }
+        }
+
+        // REQUIRES prepare_prediction() since the last change
+        // MODIFIES work
+        // EFFECTS set work.scores to the log-prior of each label plus the
+        //         log-likelihoods of word_names, as sums of dense rows
+        void add_score_rows(const std::vector<std::string_view> &word_names,
+                            PredictionScratch &work) const{
+            const ModelFile &tables = *model;
+            std::vector<double> &scores = work.scores;
+            size_t num_labels = scores.size();
+            std::copy(rows.priors(), rows.priors() + num_labels,
+                      scores.begin());
+            for (std::string_view word_name : word_names){
+                ScoreRows::add(scores.data(),
+                               rows.row(tables.find(word_name)), num_labels);
+            }
+        }
+
+        // REQUIRES prepare_prediction() since the last change
+        // MODIFIES work
+        // EFFECTS the same as add_score_rows, from the sparse tables
+        void add_score_entries(
+            const std::vector<std::string_view> &word_names,
+            PredictionScratch &work) const{
+            const ModelFile &tables = *model;
+            std::vector<double> &scores = work.scores;
+            int num_labels = tables.num_labels();
+            for (int label = 0; label < num_labels; ++label){
+                scores[label] = tables.log_prior(label);
+            }
+
+            // each label's score adds the words in sorted order, the
+            // same terms in the same order as summing label by label
+            for (std::string_view word_name : word_names){
+                int word = tables.find(word_name);
+                if (word < 0){
+                    double unknown = tables.unknown_log_likelihood();
+                    for (int label = 0; label < num_labels; ++label){
+                        scores[label] += unknown;
+                    }
+                    continue;
+                }
+                uint64_t entry = tables.entries_begin(word);
+                uint64_t end = tables.entries_end(word);
+                double fallback = tables.fallback_log_likelihood(word);
+                for (int label = 0; label < num_labels; ++label){
+                    if (entry < end && tables.entry_label(entry) == label){
+                        scores[label] += tables.entry_log_likelihood(entry++);
+                    } else {
+                        scores[label] += fallback;
+                    }
+                }
+            }
+        }
+
+        // REQUIRES prepare_prediction() since the last change, word_names
+        //          are the unique words of a post in sorted order
+        // MODIFIES work
+        // EFFECTS return the most probable label of the post and its
+        //         log-probability score
+        std::pair<std::string, double> predict_words(
+            const std::vector<std::string_view> &word_names,
+            PredictionScratch &work) const{
+            const ModelFile &tables = *model;
+            if (quantizes()){
+                find_words(word_names, work);
+                work.scores.resize(tables.num_labels());
+                quantized.score(work.delta.words, work.scores);
+                return best_label(work.scores);
+            }
+            if (scoring == Scoring::EARLY_EXIT){
+                find_words(word_names, work);
+                deltas.top(tables, 1, work.delta);
+                int best = work.delta.ranking[0];
+                return std::make_pair(std::string(tables.label_name(best)),
+                                      work.delta.scores[best]);
+            }
+            if (scoring == Scoring::SPARSE){
+                find_words(word_names, work);
+                deltas.score(tables, work.delta);
+                return best_label(work.delta.scores);
+            }
+            std::vector<double> &scores = work.scores;
+            scores.resize(tables.num_labels());
+            if (!rows.empty()){
+                add_score_rows(word_names, work);
+            } else {
+                add_score_entries(word_names, work);
+            }
+            return best_label(scores);
+        }
+
+        // MODIFIES labels, words, label_word_counts, label_counts,
+        //          word_counts, total_number_of_posts
+        // EFFECTS if a model was loaded, rebuild the counts from it so that
+        //         more posts can be counted
+        void thaw(){
+            if (!loaded){
+                return;
+            }
+            loaded = false;
+            const ModelFile &tables = *model;
+            total_number_of_posts = tables.total_posts();
+
+            for (int label = 0; label < tables.num_labels(); ++label){
+                labels.intern(tables.label_name(label));
+                label_counts.push_back(tables.label_count(label));
+            }
+            for (int word = 0; word < tables.num_words(); ++word){
+                words.intern(tables.word_name(word));
+                word_counts.push_back(tables.word_count(word));
+                uint64_t end = tables.entries_end(word);
+                for (uint64_t entry = tables.entries_begin(word); entry < end;
+                     ++entry){
+                    label_word_counts.add(tables.entry_label(entry), word,
+                                          tables.entry_count(entry));
+                }
+            }
+        }
+
+        Pruning pruning;
+
+        // Counts that the scoring tables are built from, by this
+        // classifier's label and word ids
+        struct Counts {
+            int total = 0;
+            std::vector<int> labels;
+            std::vector<int> words;
+
+            // (label id, count) of each word id, in increasing label rank
+            std::vector<std::vector<std::pair<uint32_t, int>>> entries;
+        };
+
+        // REQUIRES excluded is null, or its posts were all counted here
+        // EFFECTS return the counts, less the counts of excluded
+        Counts counts_without(const BasicClassifier *excluded) const{
+            Counts counts;
+            counts.total = total_number_of_posts;
+            counts.labels = label_counts;
+            counts.words = word_counts;
+
+            // ids of this classifier's labels and words in excluded
+            std::vector<int> excluded_labels(labels.size(), -1);
+            std::vector<int> excluded_words(words.size(), -1);
+            if (excluded){
+                counts.total -= excluded->total_number_of_posts;
+                for (int id = 0; id < labels.size(); ++id){
+                    excluded_labels[id] = excluded->labels.find(labels.name(id));
+                    if (excluded_labels[id] >= 0){
+                        counts.labels[id] -=
+                            excluded->label_counts[excluded_labels[id]];
+                    }
+                }
+                for (int id = 0; id < words.size(); ++id){
+                    excluded_words[id] = excluded->words.find(words.name(id));
+                    if (excluded_words[id] >= 0){
+                        counts.words[id] -=
+                            excluded->word_counts[excluded_words[id]];
+                    }
+                }
+            }
+
+            // A sketched count may overestimate, but never beyond the
+            // exact label and word counts
+            counts.entries.resize(words.size());
+            for (int label_id : labels.sorted_ids()){
+                label_word_counts.for_each(label_id, [&](int word_id, int n){
+                    if (excluded_labels[label_id] >= 0 &&
+                        excluded_words[word_id] >= 0){
+                        n -= excluded->label_word_counts.get(
+                            excluded_labels[label_id], excluded_words[word_id]);
+                    }
+                    n = std::min({n, counts.labels[label_id],
+                                  counts.words[word_id]});
+                    if (n > 0){
+                        counts.entries[word_id].emplace_back(label_id, n);
+                    }
+                });
+            }
+            return counts;
+        }
+
+        // EFFECTS return the mutual information, in nats, between a post
+        //         containing word_id and the label of the post
+        static double mutual_information(const Counts &counts, int word_id){
+            double total = counts.total;
+            double word_count = counts.words[word_id];
+            std::vector<int> with_label(counts.labels.size(), 0);
+            for (auto &entry : counts.entries[word_id]){
+                with_label[entry.first] = entry.second;
+            }
+
+            double information = 0;
+            for (size_t label = 0; label < counts.labels.size(); ++label){
+                double p_label = counts.labels[label] / total;
+                double cells[2][2] = {
+                    {double(counts.labels[label] - with_label[label]),
+                     (total - word_count) / total},
+                    {double(with_label[label]), word_count / total}};
+                for (auto &cell : cells){
+                    if (cell[0] > 0){
+                        double p_joint = cell[0] / total;
+                        information += p_joint *
+                            std::log(p_joint / (cell[1] * p_label));
+                    }
+                }
+            }
+            return information;
+        }
+
+        // EFFECTS return which word ids are in counts and survive pruning
+        std::vector<bool> kept_words(const Counts &counts) const{
+            // ids in sorted order, so that ties keep the first word
+            std::vector<int> ids;
+            for (int word_id : words.sorted_ids()){
+                if (counts.words[word_id] > 0 &&
+                    counts.words[word_id] >= pruning.min_document_frequency){
+                    ids.push_back(word_id);
+                }
+            }
+            if (pruning.top_k > 0 && ids.size() > pruning.top_k){
+                std::stable_sort(ids.begin(), ids.end(), [&](int a, int b){
+                    return counts.words[a] > counts.words[b];
+                });
+                ids.resize(pruning.top_k);
+            }
+            size_t top_mi = pruning.top_mutual_information;
+            if (top_mi > 0 && ids.size() > top_mi){
+                std::vector<double> information(words.size());
+                for (int word_id : ids){
+                    information[word_id] = mutual_information(counts, word_id);
+                }
+                std::stable_sort(ids.begin(), ids.end(), [&](int a, int b){
+                    return information[a] > information[b];
+                });
+                ids.resize(top_mi);
+            }
+
+            std::vector<bool> kept(words.size(), false);
+            for (int word_id : ids){
+                kept[word_id] = true;
+            }
+            return kept;
+        }
+
+        // REQUIRES excluded is null, or its posts were all counted here
+        // EFFECTS return the counts less those of excluded, with labels
+        //         and words sorted by name
+        ModelData model_data(const BasicClassifier *excluded = nullptr) const{
+            Counts counts = counts_without(excluded);
+            ModelData data;
+            data.total_posts = counts.total;
+
+            std::vector<int> label_rank(labels.size());
+            for (int label_id : labels.sorted_ids()){
+                if (counts.labels[label_id] > 0){
+                    label_rank[label_id] = data.label_names.size();
+                    data.label_names.push_back(labels.name(label_id));
+                    data.label_counts.push_back(counts.labels[label_id]);
+                }
+            }
+
+            std::vector<bool> kept = kept_words(counts);
+            data.entry_starts.push_back(0);
+            for (int word_id : words.sorted_ids()){
+                if (!kept[word_id]){
+                    continue;
+                }
+                data.word_names.push_back(words.name(word_id));
+                data.word_counts.push_back(counts.words[word_id]);
+                for (auto &entry : counts.entries[word_id]){
+                    data.entry_labels.push_back(label_rank[entry.first]);
+                    data.entry_counts.push_back(entry.second);
+                }
+                data.entry_starts.push_back(data.entry_labels.size());
+            }
+            return data;
+        }
+
+    public:
+        // EFFECTS create an untrained classifier with exact counts
+        BasicClassifier() = default;
+
+        // EFFECTS create an untrained classifier whose (label, word) counts
+        //         take about sketch_bytes, see CountMatrix::sketched
+        explicit BasicClassifier(size_t sketch_bytes)
+            : label_word_counts(CountMatrix::sketched(sketch_bytes)) {}
+
+        // EFFECTS return the unique whitespace delimited words of str in
+        //         sorted order, as views into str valid until the next call
+        const std::vector<std::string_view> & unique_words(
+            std::string_view str){
+            return scratch.tokenizer.unique_words(str);
+        }
+
+        // REQUIRES str, label, no model has been loaded (see update)
+        // MODIFIES label_word_counts, label_counts, word_counts
+        // EFFECTS count str and label under their ids
+        void train_model(std::string_view label, std::string_view str){
+            model.reset();
+            total_number_of_posts++;
+
+            int label_id = labels.intern(label);
+            if (label_id == int(label_counts.size())){
+                label_counts.push_back(0);
+            }
+            label_counts[label_id]++;
+
+            for (std::string_view word : unique_words(str)){
+                int word_id = words.intern(word);
+                if (word_id == int(word_counts.size())){
+                    word_counts.push_back(0);
+                }
+                word_counts[word_id]++;
+                label_word_counts.add(label_id, word_id);
+            }
+        }
+
+        // REQUIRES other is not this
+        // MODIFIES label_word_counts, label_counts, word_counts
+        // EFFECTS add the counts of other, matching labels and words by name
+        void merge(const BasicClassifier &other){
+            thaw();
+            model.reset();
+            total_number_of_posts += other.total_number_of_posts;
+
+            std::vector<int> label_ids(other.labels.size());
+            for (int id = 0; id < other.labels.size(); ++id){
+                label_ids[id] = labels.intern(other.labels.name(id));
+                if (label_ids[id] == int(label_counts.size())){
+                    label_counts.push_back(0);
+                }
+                label_counts[label_ids[id]] += other.label_counts[id];
+            }
+
+            std::vector<int> word_ids(other.words.size());
+            for (int id = 0; id < other.words.size(); ++id){
+                word_ids[id] = words.intern(other.words.name(id));
+                if (word_ids[id] == int(word_counts.size())){
+                    word_counts.push_back(0);
+                }
+                word_counts[word_ids[id]] += other.word_counts[id];
+            }
+
+            for (int id = 0; id < other.labels.size(); ++id){
+                other.label_word_counts.for_each(id, [&](int word, int n){
+                    label_word_counts.add(label_ids[id], word_ids[word], n);
+                });
+            }
+        }
+
+        // REQUIRES every post of part was also trained into this
+        //          classifier, and no model has been loaded
+        // EFFECTS return a classifier that predicts like one trained on
+        //         the posts of this classifier except those of part. It
+        //         only holds scoring tables; this classifier is not
+        //         modified, so several can be made at once.
+        BasicClassifier without(const BasicClassifier &part) const{
+            BasicClassifier rest;
+            rest.model = std::make_shared<const ModelFile>(model_data(&part));
+            rest.loaded = true;
+            rest.score_rows_limit = score_rows_limit;
+            rest.scoring = scoring;
+            rest.prediction_cache_entries = prediction_cache_entries;
+            return rest;
+        }
+
+        // MODIFIES this
+        // EFFECTS prune the vocabulary of the scoring tables, and of saved
+        //         models, with these settings from now on
+        void set_pruning(const Pruning &settings){
+            thaw();
+            pruning = settings;
+            model.reset();
+        }
+
+        // MODIFIES this
+        // EFFECTS count one more post, on top of a model that was trained
+        //         or loaded. The scoring tables are refreshed the next time
+        //         they are needed.
+        void update(std::string_view label, std::string_view content){
+            thaw();
+            train_model(label, content);
+        }
+
+        // MODIFIES this
+        // EFFECTS update with every row of batch
+        template <typename Batch>
+        void update_batch(const Batch &batch){
+            size_t tag_column = batch.column_index("tag");
+            size_t content_column = batch.column_index("content");
+            for (size_t i = 0; i < batch.size(); ++i){
+                update(batch.value(tag_column, i),
+                       batch.value(content_column, i));
+            }
+        }
+
+        // REQUIRES at least one post has been trained, or a model loaded
+        // MODIFIES model
+        // EFFECTS precompute the log-priors, log-likelihoods, fallback and
+        //         unknown-word log-likelihoods that scoring reads, if the
+        //         counts changed since they were last computed
+        void finalize(){
+            if (!model){
+                model = std::make_shared<const ModelFile>(model_data());
+            }
+        }
+
+        // REQUIRES at least one post has been trained, or a model loaded
+        // MODIFIES this
+        // EFFECTS write the model to filename, with quantized rows in place
+        //         of the double log-likelihoods if scoring is INT8 or FP16,
+        //         so that loading it scores from the file's rows. Throws
+        //         ModelFileError if it cannot be written.
+        void save_model(const std::string &filename){
+            finalize();
+            if (quantizes()){
+                prepare_prediction();
+                ModelFile::write(filename, model->data(), quantized.data());
+            } else if (model->quantization() != NOT_QUANTIZED){
+                ModelFile::write(filename, model->data());
+            } else {
+                model->save(filename);
+            }
+        }
+
+        // MODIFIES this
+        // EFFECTS map the model in filename and predict from it from now
+        //         on, with INT8 or FP16 scoring if it is quantized. Throws
+        //         ModelFileError if it cannot be read.
+        void load_model(const std::string &filename){
+            auto tables = std::make_shared<const ModelFile>(filename);
+            *this = BasicClassifier();
+            model = tables;
+            loaded = true;
+            if (tables->quantization() == QUANTIZED_INT8){
+                scoring = Scoring::INT8;
+            } else if (tables->quantization() == QUANTIZED_FP16){
+                scoring = Scoring::FP16;
+            }
+        }
+
+        // EFFECTS return about how many bytes the (label, word) counts
+        //         take, see CountMatrix::memory_bytes
+        size_t counts_memory_bytes() const{
+            return label_word_counts.memory_bytes();
+        }
+
+        // EFFECTS return vocabulary size
+        int get_vocabulary_size(){
+            finalize();
+            return model->num_words();
+        }
+
+        // REQUIRES 0 <= label < number of labels
+        // EFFECTS return the log-prior of the label with this rank in
+        //         sorted order
+        double log_prior_prob(int label){
+            finalize();
+            return model->log_prior(label);
+        }
+
+        // REQUIRES 0 <= label < number of labels, word is a rank in the
+        //          sorted vocabulary after pruning, or -1 for a word never
+        //          seen in training or pruned
+        // EFFECTS return the log-likelihood of word given label
+        double log_likelihood(int label, int word){
+            finalize();
+            return model->log_likelihood(label, word);
+        }
+
+        template <typename Output = std::ostream>
+        void print_label_content(std::string_view label,
+                                 std::string_view content,
+                                 Output &out = std::cout) const{
+            out << "  label = " << label <<  ", "
+            << "content = " << content << '\n';
+        }
+
+        template <typename Output = std::ostream>
+        void print_training_posts(Output &out = std::cout){
+            finalize();
+            out << "trained on " << model->total_posts()
+            << " examples" << '\n';
+        }
+
+        template <typename Output = std::ostream>
+        void print_vocabulary_size(Output &out = std::cout){
+            out << "vocabulary size = " << get_vocabulary_size() << '\n';
+        }
+
+        template <typename Output = std::ostream>
+        void print_classes(Output &out = std::cout){
+            finalize();
+            out << "classes:" << '\n';
+            for (int label = 0; label < model->num_labels(); ++label){
+                out << "  " << model->label_name(label) << ", "
+                << model->label_count(label) << " examples, log-prior = "
+                << model->log_prior(label) << '\n';
+            }
+        }
+
+        template <typename Output = std::ostream>
+        void print_classifier_parameters(Output &out = std::cout){
+            finalize();
+            out << "classifier parameters:" << '\n';
+
+            // next entry of each word; labels are visited in the order
+            // entries are sorted, so each cursor only moves forward
+            std::vector<uint64_t> next(model->num_words());
+            for (int word = 0; word < model->num_words(); ++word){
+                next[word] = model->entries_begin(word);
+            }
+            for (int label = 0; label < model->num_labels(); ++label){
+                for (int word = 0; word < model->num_words(); ++word){
+                    uint64_t entry = next[word];
+                    if (entry == model->entries_end(word) ||
+                        model->entry_label(entry) != label){
+                        continue;
+                    }
+                    out << "  " << model->label_name(label) << ":"
+                    << model->word_name(word) << ", count = "
+                    << model->entry_count(entry) << ", log-likelihood = "
+                    << model->entry_log_likelihood(entry) << '\n';
+                    next[word]++;
+                }
+            }
+        }
+
+        // MODIFIES this
+        // EFFECTS predict from dense score rows only while they take at
+        //         most bytes, and from the sparse tables otherwise; 0
+        //         always uses the sparse tables
+        void set_score_rows_limit(size_t bytes){
+            score_rows_limit = bytes;
+            rows_model.reset();
+        }
+
+        // MODIFIES this
+        // EFFECTS build what predicting needs, after which predict may be
+        //         called from several threads until this changes
+        void prepare_prediction(){
+            finalize();
+            if (rows_model != model){
+                rows_model = model;
+                rows.build(*model, quantizes() ? 0 : score_rows_limit);
+                version = 0;
+            }
+            bool sparse = scoring == Scoring::SPARSE ||
+                scoring == Scoring::EARLY_EXIT;
+            if (sparse && deltas_model != model){
+                deltas_model = model;
+                deltas.build(*model);
+            }
+            if (quantizes() && quantized_model != model){
+                quantized_model = model;
+                quantized.build(*model, quantized_format());
+            }
+            if (version == 0){
+                version = next_version();
+            }
+        }
+
+        // MODIFIES this
+        // EFFECTS predict with scoring from now on
+        void set_scoring(Scoring mode){
+            scoring = mode;
+            rows_model.reset();
+            quantized_model.reset();
+            version = 0;
+        }
+
+        // MODIFIES this
+        // EFFECTS cache up to entries predictions in each PredictionScratch
+        //         that predict is called with, see PredictionCache; 0
+        //         caches none
+        void set_prediction_cache(size_t entries){
+            prediction_cache_entries = entries;
+        }
+
+        // EFFECTS return the hits and misses of the prediction cache used
+        //         by compute_most_probable_tag
+        PredictionCache::Stats prediction_cache_stats() const{
+            return scratch.cache.stats();
+        }
+
+        // REQUIRES prepare_prediction() since the last change, scoring is
+        //          SPARSE or EARLY_EXIT, 1 <= k <= number of labels
+        // MODIFIES work
+        // EFFECTS return the k most probable labels of content, best
+        //         first, and their log-probability scores
+        std::vector<std::pair<std::string, double>> predict_top(
+            std::string_view content, size_t k,
+            PredictionScratch &work) const{
+            find_words(work.tokenizer.unique_words(content), work);
+            deltas.top(*model, k, work.delta);
+            std::vector<std::pair<std::string, double>> best;
+            for (size_t i = 0; i < k; ++i){
+                int label = work.delta.ranking[i];
+                best.emplace_back(model->label_name(label),
+                                  work.delta.scores[label]);
+            }
+            return best;
+        }
+
+        // REQUIRES prepare_prediction() since the last change
+        // MODIFIES work
+        // EFFECTS return the most probable label of content and its
+        //         log-probability score, from work.cache if it has them
+        std::pair<std::string, double> predict(std::string_view content,
+                                               PredictionScratch &work) const{
+            if (prediction_cache_entries == 0){
+                return predict_words(work.tokenizer.unique_words(content),
+                                     work);
+            }
+            PredictionCache &cache = work.cache;
+            if (cache.capacity() != prediction_cache_entries){
+                cache.set_capacity(prediction_cache_entries);
+            }
+            if (const auto *cached = cache.find(version, content)){
+                return *cached;
+            }
+            return cache.insert(
+                predict_words(work.tokenizer.unique_words(content), work));
+        }
+
+        std::pair<std::string, double> compute_most_probable_tag(
+            std::string_view content){
+            prepare_prediction();
+            return predict(content, scratch);
+        }
+
+        // EFFECTS print the prediction of a post with label tag and content
+        //         to out
+        template <typename Output>
+        static void print_prediction(Output &out, std::string_view tag,
+                                     std::string_view content,
+                                     const std::pair<std::string, double> &
+                                         prediction){
+            out << "  correct = " << tag <<  ", "
+            << "predicted = " << prediction.first <<
+            ", log-probability score = " << prediction.second << '\n';
+
+            out << "  content = " << content << '\n' << '\n';
+        }
+
+        // MODIFIES number_predicted_correct, number_test_data
+        // EFFECTS predict and print the label of every row of batch
+        template <typename Batch, typename Output>
+        void predict_batch(const Batch &batch, int &number_predicted_correct,
+                           int &number_test_data, Output &out){
+            std::pair<std::string, double> highest_prob_tag;
+            size_t tag_column = batch.column_index("tag");
+            size_t content_column = batch.column_index("content");
+
+            for (size_t i = 0; i < batch.size(); ++i){
+                number_test_data++;
+
+                std::string_view tag = batch.value(tag_column, i);
+                std::string_view content = batch.value(content_column, i);
+                highest_prob_tag = compute_most_probable_tag(content);
+                print_prediction(out, tag, content, highest_prob_tag);
+
+                if (tag == highest_prob_tag.first){
+                    number_predicted_correct++;
+                }
+            }
+        }
+
+        template <typename Output = std::ostream>
+        void predict_test_data(csvstream &csv_test_in,
+                               Output &out = std::cout){
+            int number_predicted_correct = 0;
+            int number_test_data = 0;
+            csvstream_batch batch;
+
+            out << "test data:" << '\n';
+
+            while(csv_test_in.read_batch(batch, BATCH_SIZE)){
+                predict_batch(batch, number_predicted_correct,
+                              number_test_data, out);
+            }
+
+            print_performance(number_predicted_correct, number_test_data,
+                              out);
+        }
+
+        template <typename Output = std::ostream>
+        void predict_test_data(const csvcache &test_data,
+                               Output &out = std::cout){
+            int number_predicted_correct = 0;
+            int number_test_data = 0;
+
+            out << "test data:" << '\n';
+            predict_batch(test_data, number_predicted_correct,
+                          number_test_data, out);
+            print_performance(number_predicted_correct, number_test_data,
+                              out);
+        }
+
+        template <typename Output = std::ostream>
+        void print_performance(int number_predicted_correct,
+                               int number_test_data,
+                               Output &out = std::cout){
+            out << "performance: " << number_predicted_correct << " / "
+            << number_test_data << " posts predicted correctly" << '\n';
+        }
+
+};
+
+// The dictionary of Classifier is chosen when building: std::map with
+// CLASSIFIER_STD_MAP, the project's Map with CLASSIFIER_PROJECT_MAP, and
+// std::unordered_map otherwise
+#if defined(CLASSIFIER_STD_MAP)
+using Classifier = BasicClassifier<std::map<std::string_view, int>>;
+#elif defined(CLASSIFIER_PROJECT_MAP)
+using Classifier = BasicClassifier<Map<std::string_view, int>>;
+#else
+using Classifier =
+    BasicClassifier<std::unordered_map<std::string_view, int>>;
+#endif
+
+#endif // CLASSIFIER_HPP
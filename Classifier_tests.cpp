@@ -0,0 +1,466 @@
+#include "Classifier.hpp"
+#include "test_posts.hpp"
+#include "unit_test_framework.hpp"
+#include <cmath>
+#include <map>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+
+// EFFECTS return what print_classes and print_classifier_parameters print
+static string parameters(Classifier &classifier) {
+  ostringstream out;
+  streambuf *old = cout.rdbuf(out.rdbuf());
+  classifier.print_training_posts();
+  classifier.print_vocabulary_size();
+  classifier.print_classes();
+  classifier.print_classifier_parameters();
+  cout.rdbuf(old);
+  return out.str();
+}
+
+TEST(classifier_most_probable_tag) {
+  Classifier classifier;
+  for (auto &post : POSTS) {
+    classifier.train_model(post.first, post.second);
+  }
+  ASSERT_EQUAL(classifier.get_vocabulary_size(), 34);
+  auto tag = classifier.compute_most_probable_tag("the dealer left the card");
+  ASSERT_EQUAL(tag.first, "euchre");
+  tag = classifier.compute_most_probable_tag("rotate image");
+  ASSERT_EQUAL(tag.first, "image");
+}
+
+TEST(classifier_copy_trains_after_original_is_destroyed) {
+  auto original = make_unique<Classifier>();
+  for (auto &post : POSTS) {
+    original->train_model(post.first, post.second);
+  }
+  Classifier copy = *original;
+  original.reset();
+  copy.train_model("euchre", "the dealer left the upcard");
+  copy.train_model("poker", "river card");
+  ASSERT_EQUAL(copy.get_vocabulary_size(), 35);
+  ASSERT_EQUAL(copy.compute_most_probable_tag("rotate image").first, "image");
+}
+
+// EFFECTS return the most probable label of content and its score,
+//         computing every log-probability per call from the counts of
+//         posts, as the classifier did before it kept scoring tables
+static pair<string, double> per_call_prediction(
+  const vector<pair<string, string>> &posts, const string &content) {
+  Tokenizer tokenizer;
+  map<string, int> label_counts;
+  map<string, int> word_counts;
+  map<pair<string, string>, int> label_word_counts;
+  for (auto &post : posts) {
+    label_counts[post.first]++;
+    for (string_view word : tokenizer.unique_words(post.second)) {
+      word_counts[string(word)]++;
+      label_word_counts[{post.first, string(word)}]++;
+    }
+  }
+  double total = posts.size();
+  pair<string, double> best("", 0);
+  for (auto &label : label_counts) {
+    double score = log(label.second / total);
+    for (string_view view : tokenizer.unique_words(content)) {
+      string word(view);
+      auto pair_count = label_word_counts.find({label.first, word});
+      if (pair_count != label_word_counts.end()) {
+        score += log(pair_count->second / double(label.second));
+      } else if (word_counts.count(word)) {
+        score += log(word_counts[word] / total);
+      } else {
+        score += log(1.0 / total);
+      }
+    }
+    if (best.first.empty() || score > best.second) {
+      best = make_pair(label.first, score);
+    }
+  }
+  return best;
+}
+
+TEST(classifier_tables_match_per_call_scores) {
+  Classifier classifier;
+  for (auto &post : POSTS) {
+    classifier.train_model(post.first, post.second);
+  }
+  vector<string> queries = {"the dealer left the card", "rotate image",
+                            "unseen words only", "", "stack card bower"};
+  for (auto &post : POSTS) {
+    queries.push_back(post.second);
+  }
+  for (auto &query : queries) {
+    auto expected = per_call_prediction(POSTS, query);
+    auto actual = classifier.compute_most_probable_tag(query);
+    ASSERT_EQUAL(actual.first, expected.first);
+    ASSERT_ALMOST_EQUAL(actual.second, expected.second, 1e-12);
+  }
+}
+
+TEST(classifier_merge_matches_single_pass) {
+  Classifier single;
+  for (auto &post : POSTS) {
+    single.train_model(post.first, post.second);
+  }
+
+  // Shards see labels and words in different orders
+  Classifier first_half;
+  Classifier second_half;
+  for (size_t i = 0; i < POSTS.size(); ++i) {
+    Classifier &shard = i < POSTS.size() / 2 ? second_half : first_half;
+    shard.train_model(POSTS[i].first, POSTS[i].second);
+  }
+  Classifier merged;
+  merged.merge(first_half);
+  merged.merge(second_half);
+
+  ASSERT_EQUAL(parameters(merged), parameters(single));
+  ASSERT_EQUAL(merged.compute_most_probable_tag("stack image card"),
+               single.compute_most_probable_tag("stack image card"));
+}
+
+TEST(classifier_loaded_model_matches_trained) {
+  Classifier trained;
+  for (auto &post : POSTS) {
+    trained.train_model(post.first, post.second);
+  }
+  string filename = "/tmp/Classifier_tests.model";
+  trained.save_model(filename);
+
+  Classifier loaded;
+  loaded.load_model(filename);
+  ASSERT_EQUAL(parameters(loaded), parameters(trained));
+  for (auto &post : POSTS) {
+    ASSERT_EQUAL(loaded.compute_most_probable_tag(post.second),
+                 trained.compute_most_probable_tag(post.second));
+  }
+  ASSERT_EQUAL(loaded.compute_most_probable_tag("stack image unseen"),
+               trained.compute_most_probable_tag("stack image unseen"));
+  remove(filename.c_str());
+}
+
+TEST(classifier_quantized_model_scores_like_quantized_rows) {
+  string filename = "/tmp/Classifier_tests.model";
+  for (Scoring mode : {Scoring::INT8, Scoring::FP16}) {
+    Classifier quantized;
+    for (auto &post : POSTS) {
+      quantized.train_model(post.first, post.second);
+    }
+    quantized.set_scoring(mode);
+    quantized.save_model(filename);
+
+    // the loaded model scores from its quantized rows without being told,
+    // and still prints the parameters computed from its counts
+    Classifier loaded;
+    loaded.load_model(filename);
+    ASSERT_EQUAL(parameters(loaded), parameters(quantized));
+    for (auto &post : POSTS) {
+      ASSERT_EQUAL(loaded.compute_most_probable_tag(post.second),
+                   quantized.compute_most_probable_tag(post.second));
+    }
+
+    // saved again with exact scoring, it holds the exact tables
+    Classifier exact = move(*trained());
+    loaded.set_scoring(Scoring::EXACT);
+    loaded.save_model(filename);
+    Classifier reloaded;
+    reloaded.load_model(filename);
+    ASSERT_EQUAL(reloaded.compute_most_probable_tag("stack image unseen"),
+                 exact.compute_most_probable_tag("stack image unseen"));
+  }
+  remove(filename.c_str());
+}
+
+TEST(classifier_update_loaded_model_matches_full_training) {
+  Classifier full;
+  for (auto &post : POSTS) {
+    full.train_model(post.first, post.second);
+  }
+
+  Classifier first_half;
+  for (size_t i = 0; i < POSTS.size() / 2; ++i) {
+    first_half.train_model(POSTS[i].first, POSTS[i].second);
+  }
+  string filename = "/tmp/Classifier_tests.model";
+  first_half.save_model(filename);
+
+  Classifier updated;
+  updated.load_model(filename);
+  updated.compute_most_probable_tag("card");
+  for (size_t i = POSTS.size() / 2; i < POSTS.size(); ++i) {
+    updated.update(POSTS[i].first, POSTS[i].second);
+  }
+  ASSERT_EQUAL(parameters(updated), parameters(full));
+  ASSERT_EQUAL(updated.compute_most_probable_tag("stack image card"),
+               full.compute_most_probable_tag("stack image card"));
+  remove(filename.c_str());
+}
+
+TEST(classifier_update_refreshes_tables) {
+  Classifier classifier;
+  classifier.train_model("euchre", "left bower");
+  ASSERT_EQUAL(classifier.compute_most_probable_tag("stack").first,
+               "euchre");
+  classifier.update("calculator", "stack");
+  ASSERT_EQUAL(classifier.get_vocabulary_size(), 3);
+  ASSERT_EQUAL(classifier.compute_most_probable_tag("stack").first,
+               "calculator");
+}
+
+TEST(classifier_sketch_with_room_matches_exact) {
+  Classifier exact;
+  Classifier sketched(1 << 20);
+  for (auto &post : POSTS) {
+    exact.train_model(post.first, post.second);
+    sketched.train_model(post.first, post.second);
+  }
+  ASSERT_EQUAL(parameters(sketched), parameters(exact));
+}
+
+TEST(classifier_pruning_min_document_frequency) {
+  Classifier classifier;
+  for (auto &post : POSTS) {
+    classifier.train_model(post.first, post.second);
+  }
+  Pruning pruning;
+  pruning.min_document_frequency = 2;
+  classifier.set_pruning(pruning);
+
+  // the, to, card, ever, upcard and how are in two or more posts
+  ASSERT_EQUAL(classifier.get_vocabulary_size(), 6);
+
+  // a pruned word scores exactly like a word never seen in training
+  ASSERT_EQUAL(classifier.compute_most_probable_tag("the card bower"),
+               classifier.compute_most_probable_tag("the card boxer"));
+}
+
+TEST(classifier_pruning_top_k) {
+  Classifier classifier;
+  for (auto &post : POSTS) {
+    classifier.train_model(post.first, post.second);
+  }
+  Pruning pruning;
+  pruning.top_k = 1;
+  classifier.set_pruning(pruning);
+  ASSERT_EQUAL(classifier.get_vocabulary_size(), 1);
+  // "the" is in the most posts
+  ASSERT_TRUE(classifier.log_likelihood(0, 0) !=
+              classifier.log_likelihood(0, -1));
+
+  // "the" is in 4 posts and "to" in 3; the next words are in 2
+  pruning.top_k = 2;
+  classifier.set_pruning(pruning);
+  ASSERT_EQUAL(classifier.get_vocabulary_size(), 2);
+  string kept = parameters(classifier);
+  ASSERT_TRUE(kept.find("euchre:the, count = 3") != string::npos);
+  ASSERT_TRUE(kept.find("image:the, count = 1") != string::npos);
+  ASSERT_TRUE(kept.find("calculator:to, count = 1") != string::npos);
+  ASSERT_TRUE(kept.find("image:to, count = 1") != string::npos);
+  ASSERT_TRUE(kept.find(":card,") == string::npos);
+  ASSERT_TRUE(kept.find(":how,") == string::npos);
+}
+
+TEST(classifier_pruning_mutual_information) {
+  Classifier classifier;
+  classifier.train_model("euchre", "card the");
+  classifier.train_model("euchre", "card the");
+  classifier.train_model("calculator", "stack the");
+  classifier.train_model("calculator", "the");
+  Pruning pruning;
+  pruning.top_mutual_information = 1;
+  classifier.set_pruning(pruning);
+
+  // "card" separates the labels best; "the" tells nothing
+  ostringstream out;
+  streambuf *old = cout.rdbuf(out.rdbuf());
+  classifier.print_classifier_parameters();
+  cout.rdbuf(old);
+  ASSERT_TRUE(out.str().find(":card") != string::npos);
+  ASSERT_TRUE(out.str().find(":the") == string::npos);
+}
+
+TEST(classifier_without_matches_training_on_the_rest) {
+  Classifier all;
+  Classifier part;
+  Classifier rest_trained;
+  for (size_t i = 0; i < POSTS.size(); ++i) {
+    all.train_model(POSTS[i].first, POSTS[i].second);
+    Classifier &target = i % 3 == 0 ? part : rest_trained;
+    target.train_model(POSTS[i].first, POSTS[i].second);
+  }
+
+  // words only in part's posts disappear
+  Classifier rest = all.without(part);
+  ASSERT_EQUAL(parameters(rest), parameters(rest_trained));
+  for (auto &post : POSTS) {
+    ASSERT_EQUAL(rest.compute_most_probable_tag(post.second),
+                 rest_trained.compute_most_probable_tag(post.second));
+  }
+
+  // all is unchanged
+  Classifier again;
+  for (auto &post : POSTS) {
+    again.train_model(post.first, post.second);
+  }
+  ASSERT_EQUAL(parameters(all), parameters(again));
+}
+
+TEST(classifier_score_rows_match_sparse_tables) {
+  // 11 labels, so the SIMD loops also run their scalar tails
+  Classifier dense;
+  Classifier sparse;
+  sparse.set_score_rows_limit(0);
+  for (int label = 0; label < 11; ++label) {
+    for (auto &post : POSTS) {
+      string tag = post.first + to_string(label % (label % 3 + 1));
+      dense.train_model(tag, post.second);
+      sparse.train_model(tag, post.second);
+    }
+  }
+
+  vector<string> queries = {"the dealer left the card", "rotate image",
+                            "unseen words only", ""};
+  for (auto &post : POSTS) {
+    queries.push_back(post.second);
+  }
+  ScoreRows::Simd simds[] = {ScoreRows::SCALAR, ScoreRows::AVX2,
+                             ScoreRows::AVX512};
+  for (ScoreRows::Simd simd : simds) {
+    ScoreRows::limit_simd(simd);
+    for (auto &query : queries) {
+      ASSERT_EQUAL(dense.compute_most_probable_tag(query),
+                   sparse.compute_most_probable_tag(query));
+    }
+  }
+  ScoreRows::limit_simd(ScoreRows::AVX512);
+}
+
+TEST(classifier_score_rows_keep_first_maximal_label) {
+  // every label scores the same, so the first label in sorted order wins
+  Classifier classifier;
+  for (const char *label : {"d", "b", "c", "a", "e"}) {
+    classifier.train_model(label, "same words");
+  }
+  ASSERT_EQUAL(classifier.compute_most_probable_tag("same").first, "a");
+  ASSERT_EQUAL(classifier.compute_most_probable_tag("other").first, "a");
+}
+
+TEST(classifier_sparse_scoring_matches_exact) {
+  Classifier exact;
+  for (int label = 0; label < 7; ++label) {
+    for (auto &post : POSTS) {
+      exact.train_model(post.first + to_string(label % 3), post.second);
+    }
+  }
+  exact.prepare_prediction();
+  Classifier sparse = exact.without(Classifier());
+  sparse.set_scoring(Scoring::SPARSE);
+  sparse.prepare_prediction();
+  Classifier early = exact.without(Classifier());
+  early.set_scoring(Scoring::EARLY_EXIT);
+  early.prepare_prediction();
+
+  PredictionScratch work;
+  vector<string> queries = {"the dealer left the card", "rotate image",
+                            "unseen words only"};
+  for (auto &post : POSTS) {
+    queries.push_back(post.second);
+  }
+  for (auto &query : queries) {
+    auto expected = exact.predict(query, work);
+    for (Classifier *other : {&sparse, &early}) {
+      auto actual = other->predict(query, work);
+      ASSERT_EQUAL(actual.first, expected.first);
+      ASSERT_ALMOST_EQUAL(actual.second, expected.second, 1e-9);
+    }
+  }
+}
+
+TEST(classifier_quantized_scoring_stays_close_to_exact) {
+  Classifier exact;
+  for (auto &post : POSTS) {
+    exact.train_model(post.first, post.second);
+  }
+  exact.prepare_prediction();
+
+  PredictionScratch work;
+  for (Scoring mode : {Scoring::INT8, Scoring::FP16}) {
+    Classifier quantized = exact.without(Classifier());
+    quantized.set_scoring(mode);
+    quantized.prepare_prediction();
+    for (auto &post : POSTS) {
+      auto expected = exact.predict(post.second, work);
+      auto actual = quantized.predict(post.second, work);
+      ASSERT_EQUAL(actual.first, expected.first);
+      ASSERT_ALMOST_EQUAL(actual.second, expected.second, 0.1);
+    }
+  }
+}
+
+TEST(classifier_predict_top_ranks_labels) {
+  Classifier classifier;
+  for (auto &post : POSTS) {
+    classifier.train_model(post.first, post.second);
+  }
+  classifier.set_scoring(Scoring::EARLY_EXIT);
+  classifier.prepare_prediction();
+  PredictionScratch work;
+  auto top = classifier.predict_top("the dealer left the card", 3, work);
+  ASSERT_EQUAL(top.size(), 3u);
+  ASSERT_EQUAL(top[0].first, "euchre");
+  ASSERT_TRUE(top[0].second >= top[1].second);
+  ASSERT_TRUE(top[1].second >= top[2].second);
+
+  // stopping early for fewer labels gives the same ranking and scores as
+  // scoring every label
+  for (size_t k = 1; k <= 2; ++k) {
+    auto best = classifier.predict_top("the dealer left the card", k, work);
+    for (size_t i = 0; i < k; ++i) {
+      ASSERT_EQUAL(best[i].first, top[i].first);
+      ASSERT_ALMOST_EQUAL(best[i].second, top[i].second, 1e-9);
+    }
+  }
+}
+
+TEST(classifier_prediction_cache_follows_model_changes) {
+  Classifier uncached;
+  for (auto &post : POSTS) {
+    uncached.train_model(post.first, post.second);
+  }
+  Classifier cached = uncached;
+  cached.set_prediction_cache(2);
+
+  // reordered and repeated words are the same post to the cache
+  vector<string> queries = {"rotate image", "image rotate rotate",
+                            "the dealer left the card", "rotate  image",
+                            "stack image card", "card the left dealer"};
+  for (auto &query : queries) {
+    ASSERT_EQUAL(cached.compute_most_probable_tag(query),
+                 uncached.compute_most_probable_tag(query));
+  }
+  PredictionCache::Stats stats = cached.prediction_cache_stats();
+  ASSERT_EQUAL(stats.hits, 2u);
+  ASSERT_EQUAL(stats.misses, 4u);
+
+  // new counts are a new model, whose predictions are not cached yet
+  for (Classifier *classifier : {&cached, &uncached}) {
+    classifier->update("image", "the dealer left the card");
+    classifier->update("image", "the dealer left the card");
+  }
+  ASSERT_EQUAL(cached.compute_most_probable_tag("card the left dealer"),
+               uncached.compute_most_probable_tag("card the left dealer"));
+  ASSERT_EQUAL(cached.compute_most_probable_tag("card the left dealer").first,
+               "image");
+  ASSERT_EQUAL(cached.prediction_cache_stats().misses, 5u);
+
+  // so is another way of scoring
+  cached.set_scoring(Scoring::SPARSE);
+  cached.compute_most_probable_tag("card the left dealer");
+  ASSERT_EQUAL(cached.prediction_cache_stats().misses, 6u);
+}
+
+TEST_MAIN()
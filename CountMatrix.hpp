@@ -0,0 +1,293 @@
+#ifndef COUNTMATRIX_HPP
+#define COUNTMATRIX_HPP
+/* CountMatrix.hpp
+ *
+ * Counts of (label, word) pairs, keyed by dense label and word ids. Counts
+ * live in a dense word-major matrix while labels x words is small, and in
+ * one sparse hash map per label once the matrix would exceed dense_limit
+ * entries. A sketched matrix instead bounds its memory: it keeps counts
+ * only for a fixed number of heavy pairs, and every other pair reads as
+ * never added. Every add also goes to a CountMinSketch, whose estimates
+ * never undercount. A pair that is not heavy replaces the lightest heavy
+ * pair once its estimate is larger, starting from that estimate, so the
+ * heavy pairs follow the largest counts seen so far rather than the first
+ * pairs to arrive.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "CountMinSketch.hpp"
+
+class CountMatrix {
+public:
+  // EFFECTS : Creates an empty matrix that stays dense up to dense_limit
+  //           entries.
+  explicit CountMatrix(size_t dense_limit = 1 << 22)
+    : dense_limit(dense_limit) {}
+
+  // Approximate bytes per heavy pair of a sketched matrix: its heap entry,
+  // and its node and bucket in the index
+  static constexpr size_t HEAVY_ENTRY_BYTES = 64;
+
+  // EFFECTS : Returns an empty matrix that uses about budget_bytes, a
+  //           quarter for the sketch and the rest for the counts of heavy
+  //           pairs. Heavy counts may be overestimated by the sketch's
+  //           estimate when they became heavy; other pairs read as 0.
+  static CountMatrix sketched(size_t budget_bytes) {
+    CountMatrix counts(0);
+    counts.dense_mode = false;
+    counts.sketch.emplace(budget_bytes / 4);
+    counts.heavy_capacity = budget_bytes * 3 / 4 / HEAVY_ENTRY_BYTES;
+    counts.heavy.reserve(counts.heavy_capacity);
+    counts.heavy_index.reserve(counts.heavy_capacity);
+    return counts;
+  }
+
+  // REQUIRES: label >= 0, word >= 0
+  // MODIFIES: this
+  // EFFECTS : Adds amount to the count of (label, word).
+  void add(int label, int word, int amount = 1) {
+    if (sketch) {
+      add_sketched(label, word, amount);
+      return;
+    }
+    if (dense_mode) {
+      if (label >= label_capacity || word >= num_words) {
+        grow(label, word);
+      }
+    }
+    if (dense_mode) {
+      dense[size_t(word) * label_capacity + label] += amount;
+    } else {
+      if (label >= int(sparse.size())) {
+        sparse.resize(label + 1);
+      }
+      sparse[label][word] += amount;
+    }
+  }
+
+  // EFFECTS : Returns the count of (label, word), 0 if never added.
+  int get(int label, int word) const {
+    if (sketch) {
+      return get_sketched(label, word);
+    }
+    if (dense_mode) {
+      if (label >= label_capacity || word >= num_words) {
+        return 0;
+      }
+      return dense[size_t(word) * label_capacity + label];
+    }
+    if (label >= int(sparse.size())) {
+      return 0;
+    }
+    auto it = sparse[label].find(word);
+    return it == sparse[label].end() ? 0 : it->second;
+  }
+
+  // EFFECTS : Calls f(word, count) for every word with a nonzero count
+  //           for label, in unspecified order.
+  template <typename Func>
+  void for_each(int label, Func f) const {
+    if (sketch) {
+      for (const HeavyPair &pair : heavy) {
+        if (int(pair.key >> 32) == label) {
+          f(int(uint32_t(pair.key)), pair.count);
+        }
+      }
+    } else if (dense_mode) {
+      if (label >= label_capacity) {
+        return;
+      }
+      for (int word = 0; word < num_words; ++word) {
+        int count = dense[size_t(word) * label_capacity + label];
+        if (count != 0) {
+          f(word, count);
+        }
+      }
+    } else if (label < int(sparse.size())) {
+      for (const auto &entry : sparse[label]) {
+        f(entry.first, entry.second);
+      }
+    }
+  }
+
+  // EFFECTS : Returns whether counts are stored in the dense matrix.
+  bool is_dense() const {
+    return dense_mode;
+  }
+
+  // EFFECTS : Returns whether counts are approximated by a sketch.
+  bool is_sketched() const {
+    return sketch.has_value();
+  }
+
+  // EFFECTS : Returns the number of heavy pairs of a sketched matrix.
+  size_t num_heavy() const {
+    return heavy.size();
+  }
+
+  // EFFECTS : Returns about how many bytes the counts take.
+  size_t memory_bytes() const {
+    if (sketch) {
+      return sketch->memory_bytes() + heavy_capacity * HEAVY_ENTRY_BYTES;
+    }
+    if (dense_mode) {
+      return dense.size() * sizeof(int);
+    }
+    size_t pairs = 0;
+    for (const auto &counts : sparse) {
+      pairs += counts.size();
+    }
+    // a node of key, count and next pointer, and a bucket pointer
+    return pairs * (sizeof(void *) * 2 + 2 * sizeof(int));
+  }
+
+private:
+  size_t dense_limit;
+  bool dense_mode = true;
+
+  // Dense storage: the count of (label, word) is at
+  // dense[word * label_capacity + label]
+  std::vector<int> dense;
+  int label_capacity = 0;
+  int num_words = 0;
+
+  // Sparse storage: sparse[label] maps word to count
+  std::vector<std::unordered_map<int, int>> sparse;
+
+  // Sketched storage: heavy is a min-heap by count of at most
+  // heavy_capacity pairs keyed by key(label, word), and heavy_index maps
+  // each of their keys to its position in heavy. sketch estimates the
+  // count of every pair ever added.
+  struct HeavyPair {
+    uint64_t key;
+    int count;
+  };
+  std::optional<CountMinSketch> sketch;
+  std::vector<HeavyPair> heavy;
+  std::unordered_map<uint64_t, size_t> heavy_index;
+  size_t heavy_capacity = 0;
+
+  static uint64_t key(int label, int word) {
+    return uint64_t(label) << 32 | uint32_t(word);
+  }
+
+  // REQUIRES: sketch
+  // MODIFIES: this
+  // EFFECTS : Adds amount to the count of (label, word), making it heavy
+  //           if there is room or if its estimate now exceeds the count of
+  //           the lightest heavy pair, which it replaces.
+  void add_sketched(int label, int word, int amount) {
+    uint64_t pair_key = key(label, word);
+    int estimate = sketch->add(pair_key, amount);
+    auto it = heavy_index.find(pair_key);
+    if (it != heavy_index.end()) {
+      heavy[it->second].count += amount;
+      sift_down(it->second);
+      return;
+    }
+    if (heavy.size() < heavy_capacity) {
+      heavy.push_back(HeavyPair{pair_key, estimate});
+      heavy_index.emplace(pair_key, heavy.size() - 1);
+      sift_up(heavy.size() - 1);
+    } else if (!heavy.empty() && estimate > heavy[0].count) {
+      heavy_index.erase(heavy[0].key);
+      heavy[0] = HeavyPair{pair_key, estimate};
+      heavy_index.emplace(pair_key, 0);
+      sift_down(0);
+    }
+  }
+
+  // REQUIRES: sketch
+  // EFFECTS : Returns the count of (label, word) if it is heavy, or 0.
+  int get_sketched(int label, int word) const {
+    auto it = heavy_index.find(key(label, word));
+    return it == heavy_index.end() ? 0 : heavy[it->second].count;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Swaps the heavy pairs at positions a and b.
+  void swap_heavy(size_t a, size_t b) {
+    std::swap(heavy[a], heavy[b]);
+    heavy_index[heavy[a].key] = a;
+    heavy_index[heavy[b].key] = b;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Restores the heap order of heavy above position i.
+  void sift_up(size_t i) {
+    while (i > 0 && heavy[i].count < heavy[(i - 1) / 2].count) {
+      swap_heavy(i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Restores the heap order of heavy below position i.
+  void sift_down(size_t i) {
+    while (true) {
+      size_t lightest = i;
+      for (size_t child = 2 * i + 1; child <= 2 * i + 2; ++child) {
+        if (child < heavy.size() &&
+            heavy[child].count < heavy[lightest].count) {
+          lightest = child;
+        }
+      }
+      if (lightest == i) {
+        return;
+      }
+      swap_heavy(i, lightest);
+      i = lightest;
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Makes room for (label, word), switching to sparse storage if
+  //           the dense matrix would exceed dense_limit entries.
+  void grow(int label, int word) {
+    int new_capacity = label_capacity;
+    while (new_capacity <= label) {
+      new_capacity = new_capacity ? new_capacity * 2 : 1;
+    }
+    int new_words = word >= num_words ? word + 1 : num_words;
+    if (size_t(new_capacity) * new_words > dense_limit) {
+      to_sparse();
+      return;
+    }
+
+    if (new_capacity != label_capacity) {
+      // Restride the matrix for the larger label capacity
+      std::vector<int> wider(size_t(new_capacity) * new_words, 0);
+      for (int w = 0; w < num_words; ++w) {
+        for (int l = 0; l < label_capacity; ++l) {
+          wider[size_t(w) * new_capacity + l] =
+            dense[size_t(w) * label_capacity + l];
+        }
+      }
+      dense.swap(wider);
+      label_capacity = new_capacity;
+    } else {
+      dense.resize(size_t(label_capacity) * new_words, 0);
+    }
+    num_words = new_words;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Moves every count from the dense matrix to sparse storage.
+  void to_sparse() {
+    sparse.resize(label_capacity);
+    for (int l = 0; l < label_capacity; ++l) {
+      for_each(l, [this, l](int w, int count) {
+        sparse[l][w] = count;
+      });
+    }
+    dense_mode = false;
+    std::vector<int>().swap(dense);
+  }
+};
+
+#endif // COUNTMATRIX_HPP
@@ -0,0 +1,221 @@
+#include "CountMatrix.hpp"
+#include "Interner.hpp"
+#include "Map.hpp"
+#include "unit_test_framework.hpp"
+#include <map>
+#include <memory>
+
+using namespace std;
+
+TEST(count_matrix_empty) {
+  CountMatrix counts;
+  ASSERT_EQUAL(counts.get(0, 0), 0);
+  ASSERT_EQUAL(counts.get(3, 7), 0);
+  ASSERT_TRUE(counts.is_dense());
+}
+
+TEST(count_matrix_add_dense) {
+  CountMatrix counts;
+  counts.add(0, 0);
+  counts.add(0, 0);
+  counts.add(2, 5, 3);
+  ASSERT_EQUAL(counts.get(0, 0), 2);
+  ASSERT_EQUAL(counts.get(2, 5), 3);
+  ASSERT_EQUAL(counts.get(1, 5), 0);
+  ASSERT_TRUE(counts.is_dense());
+}
+
+TEST(count_matrix_new_label_keeps_counts) {
+  CountMatrix counts;
+  for (int w = 0; w < 10; ++w) {
+    counts.add(0, w, w + 1);
+  }
+  counts.add(4, 3);
+  for (int w = 0; w < 10; ++w) {
+    ASSERT_EQUAL(counts.get(0, w), w + 1);
+  }
+  ASSERT_EQUAL(counts.get(4, 3), 1);
+}
+
+TEST(count_matrix_switches_to_sparse) {
+  CountMatrix counts(64);
+  map<pair<int, int>, int> expected;
+  for (int i = 0; i < 500; ++i) {
+    int label = i % 5;
+    int word = (i * 37) % 101;
+    counts.add(label, word);
+    expected[make_pair(label, word)]++;
+  }
+  ASSERT_FALSE(counts.is_dense());
+  for (auto &entry : expected) {
+    ASSERT_EQUAL(counts.get(entry.first.first, entry.first.second),
+                 entry.second);
+  }
+
+  // for_each visits exactly the nonzero counts of one label
+  map<int, int> label_two;
+  counts.for_each(2, [&](int word, int count) { label_two[word] = count; });
+  for (auto &entry : expected) {
+    if (entry.first.first == 2) {
+      ASSERT_EQUAL(label_two[entry.first.second], entry.second);
+    }
+  }
+  ASSERT_EQUAL(counts.get(9, 0), 0);
+}
+
+TEST(count_min_sketch_never_undercounts) {
+  CountMinSketch sketch(256);
+  map<uint64_t, uint32_t> expected;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    uint64_t key = (i * 7919) % 211;
+    sketch.add(key);
+    expected[key]++;
+  }
+  ASSERT_TRUE(sketch.memory_bytes() <= 256u);
+  for (auto &entry : expected) {
+    ASSERT_TRUE(sketch.estimate(entry.first) >= entry.second);
+  }
+}
+
+TEST(count_min_sketch_exact_without_collisions) {
+  CountMinSketch sketch(1 << 20);
+  sketch.add(1, 5);
+  sketch.add(2);
+  sketch.add(1);
+  ASSERT_EQUAL(sketch.estimate(1), 6u);
+  ASSERT_EQUAL(sketch.estimate(2), 1u);
+  ASSERT_EQUAL(sketch.estimate(3), 0u);
+}
+
+TEST(count_matrix_sketched_counts_heavy_pairs_exactly) {
+  CountMatrix counts = CountMatrix::sketched(4096);
+  ASSERT_TRUE(counts.is_sketched());
+  size_t capacity = 4096 * 3 / 4 / CountMatrix::HEAVY_ENTRY_BYTES;
+  for (int i = 0; i < 100; ++i) {
+    counts.add(1, 2);
+  }
+  counts.add(0, 5, 3);
+  ASSERT_EQUAL(counts.num_heavy(), 2u);
+  ASSERT_EQUAL(counts.get(1, 2), 100);
+  ASSERT_EQUAL(counts.get(0, 5), 3);
+  ASSERT_EQUAL(counts.get(7, 2), 0);
+
+  // A small budget has room for few heavy pairs; the rest read as 0, and
+  // the heaviest pair is never the one replaced
+  for (int word = 0; word < 1000; ++word) {
+    counts.add(word % 2, word + 10);
+  }
+  ASSERT_EQUAL(counts.num_heavy(), capacity);
+  ASSERT_EQUAL(counts.get(1, 2), 100);
+  ASSERT_TRUE(counts.memory_bytes() <= 4096u);
+
+  // for_each visits only the heavy pairs
+  size_t visited = 0;
+  for (int label = 0; label < 2; ++label) {
+    counts.for_each(label, [&](int word, int count) {
+      ASSERT_EQUAL(counts.get(label, word), count);
+      ASSERT_TRUE(count > 0);
+      ++visited;
+    });
+  }
+  ASSERT_EQUAL(visited, capacity);
+  ASSERT_EQUAL(counts.get(0, 5000), 0);
+}
+
+TEST(count_matrix_sketched_keeps_late_heavy_hitters) {
+  // The first pairs to arrive fill the heavy pairs, but a pair that comes
+  // later and more often replaces them
+  CountMatrix counts = CountMatrix::sketched(1 << 14);
+  size_t capacity = (1 << 14) * 3 / 4 / CountMatrix::HEAVY_ENTRY_BYTES;
+  for (size_t word = 0; word < 2 * capacity; ++word) {
+    counts.add(0, word);
+  }
+  for (int i = 0; i < 50; ++i) {
+    counts.add(1, 7);
+    counts.add(0, 100000 + i);
+  }
+  ASSERT_EQUAL(counts.num_heavy(), capacity);
+  int count = counts.get(1, 7);
+  ASSERT_TRUE(count >= 50);
+  ASSERT_TRUE(count <= 52);
+
+  bool found = false;
+  counts.for_each(1, [&](int word, int n) {
+    found = found || (word == 7 && n == count);
+  });
+  ASSERT_TRUE(found);
+}
+
+TEST(interner_ids) {
+  Interner interner;
+  ASSERT_EQUAL(interner.intern("euchre"), 0);
+  ASSERT_EQUAL(interner.intern("calculator"), 1);
+  ASSERT_EQUAL(interner.intern("euchre"), 0);
+  ASSERT_EQUAL(interner.find("calculator"), 1);
+  ASSERT_EQUAL(interner.find("image"), -1);
+  ASSERT_EQUAL(interner.name(1), "calculator");
+  ASSERT_EQUAL(interner.size(), 2);
+}
+
+TEST(interner_sorted_ids) {
+  Interner interner;
+  interner.intern("c");
+  interner.intern("a");
+  interner.intern("b");
+  vector<int> sorted = interner.sorted_ids();
+  ASSERT_EQUAL(sorted[0], 1);
+  ASSERT_EQUAL(sorted[1], 2);
+  ASSERT_EQUAL(sorted[2], 0);
+}
+
+TEST(interner_many_short_strings) {
+  // Short strings live inside the string object, so their views must
+  // survive the container growing
+  Interner interner;
+  for (int i = 0; i < 10000; ++i) {
+    interner.intern(to_string(i));
+  }
+  for (int i = 0; i < 10000; ++i) {
+    ASSERT_EQUAL(interner.find(to_string(i)), i);
+  }
+}
+
+TEST(interner_copy_outlives_original) {
+  auto original = make_unique<Interner<>>();
+  original->intern("euchre");
+  original->intern("calculator");
+  Interner<> copy = *original;
+  Interner<> assigned;
+  assigned.intern("image");
+  assigned = *original;
+  original.reset();
+  for (Interner<> *interner : {&copy, &assigned}) {
+    ASSERT_EQUAL(interner->find("calculator"), 1);
+    ASSERT_EQUAL(interner->find("image"), -1);
+    ASSERT_EQUAL(interner->intern("euchre"), 0);
+    ASSERT_EQUAL(interner->intern("image"), 2);
+  }
+}
+
+// EFFECTS check that an Interner on Dictionary assigns and finds ids
+template <typename Dictionary>
+static void check_interner_dictionary() {
+  Interner<Dictionary> interner;
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQUAL(interner.intern(to_string(i * 7919 % 1000)), i);
+  }
+  ASSERT_EQUAL(interner.intern("0"), 0);
+  ASSERT_EQUAL(interner.find("919"), 1);
+  ASSERT_EQUAL(interner.find("calculator"), -1);
+  ASSERT_EQUAL(interner.size(), 1000);
+}
+
+TEST(interner_std_map) {
+  check_interner_dictionary<map<string_view, int>>();
+}
+
+TEST(interner_project_map) {
+  check_interner_dictionary<Map<string_view, int>>();
+}
+
+TEST_MAIN()
@@ -0,0 +1,76 @@
+#ifndef COUNTMINSKETCH_HPP
+#define COUNTMINSKETCH_HPP
+/* CountMinSketch.hpp
+ *
+ * Approximate counts of 64-bit keys in a fixed amount of memory. Each key
+ * is hashed to one counter in each of depth rows, and its estimate is the
+ * smallest of those counters, so estimates never undercount. Adds use
+ * conservative update: only counters below the new estimate are raised,
+ * which keeps overcounting from collisions low.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CountMinSketch {
+public:
+  // REQUIRES: depth >= 1
+  // EFFECTS : Creates an empty sketch of depth rows using at most
+  //           budget_bytes of counters, with at least one per row. Rows
+  //           have a power-of-two width.
+  explicit CountMinSketch(size_t budget_bytes, int depth = 4)
+    : depth(depth) {
+    width = 1;
+    while (2 * width * depth * sizeof(uint32_t) <= budget_bytes) {
+      width *= 2;
+    }
+    counters.assign(width * depth, 0);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Adds amount to the count of key, and returns its new
+  //           estimate.
+  uint32_t add(uint64_t key, uint32_t amount = 1) {
+    uint32_t target = estimate(key) + amount;
+    for (int row = 0; row < depth; ++row) {
+      uint32_t &counter = counters[index(key, row)];
+      counter = std::max(counter, target);
+    }
+    return target;
+  }
+
+  // EFFECTS : Returns an upper bound on the count of key.
+  uint32_t estimate(uint64_t key) const {
+    uint32_t smallest = UINT32_MAX;
+    for (int row = 0; row < depth; ++row) {
+      smallest = std::min(smallest, counters[index(key, row)]);
+    }
+    return smallest;
+  }
+
+  // EFFECTS : Returns the number of bytes of counters.
+  size_t memory_bytes() const {
+    return counters.size() * sizeof(uint32_t);
+  }
+
+private:
+  int depth;
+  size_t width;
+
+  // counters[row * width + column]
+  std::vector<uint32_t> counters;
+
+  // EFFECTS : Returns the counter of key in row, from an independent
+  //           splitmix64 hash per row.
+  size_t index(uint64_t key, int row) const {
+    uint64_t h = key + 0x9e3779b97f4a7c15ull * (row + 1);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return row * width + (h & (width - 1));
+  }
+};
+
+#endif // COUNTMINSKETCH_HPP
@@ -0,0 +1,234 @@
+#ifndef DELTAINDEX_HPP
+#define DELTAINDEX_HPP
+/* DeltaIndex.hpp
+ *
+ * Sparse scoring over a ModelFile. A word that was never seen with a label
+ * scores its fallback log-likelihood, which does not depend on the label,
+ * so every label's score is a shared baseline, its log-prior plus the
+ * fallbacks of all the post's words, plus a delta for each (label, word)
+ * pair that was actually seen in training. The model's entries already
+ * list, for each word, the labels it was seen with; the index adds the
+ * delta of each entry and bounds on the deltas of each word, so scoring
+ * touches only the pairs present in the post.
+ *
+ * top() can also stop early: once the remaining words cannot raise any
+ * other label above the k best, the rest of the post is scored for those
+ * k labels only.
+ *
+ * Each label adds the same terms as scoring word by word, but in a
+ * different order, so scores can differ in the last bits and exact ties
+ * can break differently.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "ModelFile.hpp"
+
+class DeltaIndex {
+public:
+  // State of scoring one post, reused from post to post
+  struct Work {
+    // word ids of the post, -1 for a word never seen in training
+    std::vector<int> words;
+
+    // score of each label
+    std::vector<double> scores;
+
+    // labels, best first after top()
+    std::vector<int> ranking;
+  };
+
+  // MODIFIES: this
+  // EFFECTS : Builds the deltas of model.
+  void build(const ModelFile &model) {
+    size_t words = model.num_words();
+    deltas.assign(words ? model.entries_end(words - 1) : 0, 0);
+    raise.assign(words, 0);
+    lower.assign(words, 0);
+    for (size_t word = 0; word < words; ++word) {
+      double fallback = model.fallback_log_likelihood(word);
+      for (uint64_t entry = model.entries_begin(word);
+           entry < model.entries_end(word); ++entry) {
+        double delta = model.entry_log_likelihood(entry) - fallback;
+        deltas[entry] = delta;
+        raise[word] = std::max(raise[word], delta);
+        lower[word] = std::min(lower[word], delta);
+      }
+    }
+  }
+
+  // REQUIRES: build(model) was the last change, work.words is set
+  // MODIFIES: work.scores
+  // EFFECTS : Sets work.scores to the score of each label.
+  void score(const ModelFile &model, Work &work) const {
+    start(model, work);
+    for (int word : work.words) {
+      add(model, word, work.scores);
+    }
+  }
+
+  // REQUIRES: build(model) was the last change, work.words is set,
+  //           1 <= k <= model.num_labels()
+  // MODIFIES: work
+  // EFFECTS : Sets the first k labels of work.ranking to the k best labels,
+  //           best first, with ties going to the lower label, and their
+  //           entries of work.scores to their scores. Other scores are
+  //           left partial.
+  void top(const ModelFile &model, size_t k, Work &work) const {
+    start(model, work);
+    std::vector<int> &words = work.words;
+
+    // words that can move scores the most first, so the bounds on the
+    // rest shrink quickly
+    std::sort(words.begin(), words.end(), [this](int a, int b) {
+      return spread(a) > spread(b);
+    });
+    double can_raise = 0;
+    double can_lower = 0;
+    for (int word : words) {
+      can_raise += word < 0 ? 0 : raise[word];
+      can_lower += word < 0 ? 0 : lower[word];
+    }
+
+    // the gap between the k best labels and the rest changes by at most
+    // the spread of each word added, so after finding it, the next check
+    // waits until enough spread has been added for it to pass
+    double added = 0;
+    double next_check = 0;
+    size_t next = 0;
+    while (next < words.size()) {
+      int word = words[next++];
+      add(model, word, work.scores);
+      can_raise -= word < 0 ? 0 : raise[word];
+      can_lower -= word < 0 ? 0 : lower[word];
+      added += spread(word);
+      if (added >= next_check) {
+        double remaining = can_raise - can_lower;
+        double found = gap(k, work);
+        if (found > remaining) {
+          break;
+        }
+        next_check = added + (remaining - found) / 2;
+      }
+    }
+
+    best(k, work);
+    for (; next < words.size(); ++next) {
+      for (size_t i = 0; i < k; ++i) {
+        int label = work.ranking[i];
+        work.scores[label] += delta(model, label, words[next]);
+      }
+    }
+    std::sort(work.ranking.begin(), work.ranking.begin() + k,
+              Better{work.scores});
+  }
+
+private:
+  // delta of each entry of the model
+  std::vector<double> deltas;
+
+  // largest delta of each word, or 0, and smallest delta, or 0
+  std::vector<double> raise;
+  std::vector<double> lower;
+
+  // Orders labels from best to worst by scores, ties going to the lower
+  // label
+  struct Better {
+    const std::vector<double> &scores;
+
+    bool operator()(int a, int b) const {
+      return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    }
+  };
+
+  // EFFECTS : Returns how far word can move scores apart.
+  double spread(int word) const {
+    return word < 0 ? 0 : raise[word] - lower[word];
+  }
+
+  // MODIFIES: work.scores
+  // EFFECTS : Sets the scores to the baseline of the post.
+  static void start(const ModelFile &model, Work &work) {
+    double baseline = 0;
+    for (int word : work.words) {
+      baseline += word < 0 ? model.unknown_log_likelihood()
+                           : model.fallback_log_likelihood(word);
+    }
+    work.scores.resize(model.num_labels());
+    for (int label = 0; label < model.num_labels(); ++label) {
+      work.scores[label] = model.log_prior(label) + baseline;
+    }
+  }
+
+  // MODIFIES: scores
+  // EFFECTS : Adds the deltas of word to the labels it was seen with.
+  void add(const ModelFile &model, int word,
+           std::vector<double> &scores) const {
+    if (word < 0) {
+      return;
+    }
+    for (uint64_t entry = model.entries_begin(word);
+         entry < model.entries_end(word); ++entry) {
+      scores[model.entry_label(entry)] += deltas[entry];
+    }
+  }
+
+  // EFFECTS : Returns the delta of word for label.
+  double delta(const ModelFile &model, int label, int word) const {
+    if (word < 0) {
+      return 0;
+    }
+    uint64_t first = model.entries_begin(word);
+    uint64_t last = model.entries_end(word);
+    while (first < last) {
+      uint64_t middle = first + (last - first) / 2;
+      if (model.entry_label(middle) < label) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+    bool found = first < model.entries_end(word) &&
+                 model.entry_label(first) == label;
+    return found ? deltas[first] : 0;
+  }
+
+  // REQUIRES: count <= number of labels
+  // MODIFIES: work.ranking
+  // EFFECTS : Sets work.ranking to the count best labels by work.scores,
+  //           best first. Takes one pass over the labels, which for small
+  //           counts is much cheaper than sorting them.
+  static void best(size_t count, Work &work) {
+    std::vector<int> &ranking = work.ranking;
+    Better better{work.scores};
+    ranking.clear();
+    for (int label = 0; label < int(work.scores.size()); ++label) {
+      if (ranking.size() == count) {
+        if (!better(label, ranking.back())) {
+          continue;
+        }
+        ranking.pop_back();
+      }
+      ranking.insert(std::upper_bound(ranking.begin(), ranking.end(), label,
+                                      better),
+                     label);
+    }
+  }
+
+  // MODIFIES: work.ranking
+  // EFFECTS : Returns how far the worst of the k best labels by
+  //           work.scores is ahead of the best of the others, or -infinity
+  //           if there are no others.
+  static double gap(size_t k, Work &work) {
+    if (k >= work.scores.size()) {
+      return -std::numeric_limits<double>::infinity();
+    }
+    best(k + 1, work);
+    return work.scores[work.ranking[k - 1]] - work.scores[work.ranking[k]];
+  }
+};
+
+#endif // DELTAINDEX_HPP
@@ -0,0 +1,240 @@
+#ifndef HASHEDCLASSIFIER_HPP
+#define HASHEDCLASSIFIER_HPP
+/* HashedClassifier.hpp
+ *
+ * Bernoulli naive Bayes over hashed features, for vocabularies too large
+ * to keep. Words are never stored: each word is hashed into one of 2^bits
+ * buckets, and a post is the set of buckets of its words. Counts of posts
+ * per label and bucket live in flat arrays, so memory depends only on the
+ * number of buckets and labels, however many distinct words training
+ * sees. Words that share a bucket are counted as one feature, which is
+ * where accuracy is lost as bits shrinks.
+ *
+ * With an order above 1, runs of up to order consecutive words are
+ * features too, hashed into the same buckets as single words by the
+ * Tokenizer's rolling hash, so bigrams and trigrams cost no strings and no
+ * memory beyond the buckets.
+ *
+ * Scores use the same estimates as Classifier, with buckets in place of
+ * words, and are added up as dense rows of log-likelihoods, see ScoreRows.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Classifier.hpp"
+#include "Interner.hpp"
+#include "ScoreRows.hpp"
+#include "Tokenizer.hpp"
+
+class HashedClassifier {
+public:
+  // Most bits accepted, for at most 2^24 buckets
+  static const int MAX_BITS = 24;
+
+  // REQUIRES: 0 <= bits <= MAX_BITS, 1 <= order <= Tokenizer::MAX_ORDER
+  // EFFECTS : Creates an untrained classifier with 2^bits buckets, whose
+  //           features are runs of 1 to order words.
+  explicit HashedClassifier(int bits, int order = 1)
+    : mask((uint64_t(1) << bits) - 1), order(order),
+      bucket_counts(mask + 1, 0) {}
+
+  // EFFECTS : Returns the bucket of word.
+  int bucket(std::string_view word) const {
+    return int(Tokenizer::mix(Tokenizer::word_hash(word)) & mask);
+  }
+
+  // EFFECTS : Returns the longest run of words counted as a feature.
+  int ngram_order() const {
+    return order;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Counts a post with label and content.
+  void train_model(std::string_view label, std::string_view content) {
+    prepared = false;
+    total_number_of_posts++;
+    int label_id = labels.intern(label);
+    if (label_id == int(label_counts.size())) {
+      label_counts.push_back(0);
+      label_bucket_counts.emplace_back(mask + 1, 0);
+    }
+    label_counts[label_id]++;
+
+    find_buckets(content, scratch);
+    std::vector<int> &counts = label_bucket_counts[label_id];
+    for (int b : scratch.buckets) {
+      bucket_counts[b]++;
+      counts[b]++;
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Counts every row of batch.
+  template <typename Batch>
+  void train_batch(const Batch &batch) {
+    size_t tag_column = batch.column_index("tag");
+    size_t content_column = batch.column_index("content");
+    for (size_t i = 0; i < batch.size(); ++i) {
+      train_model(batch.value(tag_column, i), batch.value(content_column, i));
+    }
+  }
+
+  // EFFECTS : Returns the number of posts trained.
+  int total_posts() const {
+    return total_number_of_posts;
+  }
+
+  // EFFECTS : Returns the number of buckets.
+  size_t num_buckets() const {
+    return bucket_counts.size();
+  }
+
+  // EFFECTS : Returns the bytes taken by counts and score rows, which do
+  //           not grow with the vocabulary.
+  size_t memory_bytes() const {
+    size_t labels_size = label_counts.size();
+    return (labels_size + 1) * num_buckets() * sizeof(int) +
+      (num_buckets() + 1) * labels_size * sizeof(double);
+  }
+
+  // REQUIRES: at least one post has been trained
+  // MODIFIES: this
+  // EFFECTS : Builds the score rows from the counts if they changed, after
+  //           which predict may be called from several threads until this
+  //           is trained again.
+  void prepare_prediction() {
+    if (prepared) {
+      return;
+    }
+    prepared = true;
+    // labels in sorted order, so the first maximal label wins ties
+    label_order = labels.sorted_ids();
+    size_t num_labels = label_order.size();
+    double total = total_number_of_posts;
+    double unknown = std::log(1.0 / total);
+    rows.assign((num_buckets() + 1) * num_labels, unknown);
+    for (size_t rank = 0; rank < num_labels; ++rank) {
+      rows[rank] = std::log(label_counts[label_order[rank]] / total);
+    }
+    for (size_t b = 0; b < num_buckets(); ++b) {
+      if (bucket_counts[b] == 0) {
+        continue;
+      }
+      double *row = &rows[(b + 1) * num_labels];
+      double fallback = std::log(bucket_counts[b] / total);
+      for (size_t rank = 0; rank < num_labels; ++rank) {
+        int label_id = label_order[rank];
+        double count = label_bucket_counts[label_id][b];
+        row[rank] = count > 0
+          ? std::log(count / label_counts[label_id]) : fallback;
+      }
+    }
+  }
+
+  // REQUIRES: prepare_prediction() since the last change
+  // MODIFIES: work
+  // EFFECTS : Returns the most probable label of content and its
+  //           log-probability score.
+  std::pair<std::string, double> predict(std::string_view content,
+                                         PredictionScratch &work) const {
+    size_t num_labels = label_order.size();
+    std::vector<double> &scores = work.scores;
+    scores.assign(rows.begin(), rows.begin() + num_labels);
+    find_buckets(content, work);
+    for (int b : work.buckets) {
+      ScoreRows::add(scores.data(), &rows[(b + 1) * num_labels], num_labels);
+    }
+    size_t best = 0;
+    for (size_t rank = 1; rank < num_labels; ++rank) {
+      if (scores[rank] > scores[best]) {
+        best = rank;
+      }
+    }
+    return std::make_pair(labels.name(label_order[best]), scores[best]);
+  }
+
+  // REQUIRES: at least one post has been trained
+  // MODIFIES: this
+  // EFFECTS : Returns the most probable label of content and its
+  //           log-probability score.
+  std::pair<std::string, double> compute_most_probable_tag(
+    std::string_view content) {
+    prepare_prediction();
+    return predict(content, scratch);
+  }
+
+  // MODIFIES: out
+  // EFFECTS : Prints the number of posts trained to out.
+  template <typename Output>
+  void print_training_posts(Output &out) const {
+    out << "trained on " << total_number_of_posts << " examples" << '\n';
+  }
+
+  // MODIFIES: this, out
+  // EFFECTS : Predicts and prints every row of csv_test_in to out as
+  //           Classifier does, then prints the accuracy.
+  template <typename Output>
+  void predict_test_data(csvstream &csv_test_in, Output &out) {
+    int number_correct = 0;
+    int number_test_data = 0;
+    csvstream_batch batch;
+    out << "test data:" << '\n';
+    while (csv_test_in.read_batch(batch, BATCH_SIZE)) {
+      size_t tag_column = batch.column_index("tag");
+      size_t content_column = batch.column_index("content");
+      for (size_t i = 0; i < batch.size(); ++i) {
+        std::string_view tag = batch.value(tag_column, i);
+        std::string_view content = batch.value(content_column, i);
+        auto prediction = compute_most_probable_tag(content);
+        Classifier::print_prediction(out, tag, content, prediction);
+        number_correct += tag == prediction.first;
+        number_test_data++;
+      }
+    }
+    out << "performance: " << number_correct << " / " << number_test_data
+        << " posts predicted correctly" << '\n';
+  }
+
+private:
+  uint64_t mask;
+  int order;
+  Interner<> labels;
+  std::vector<int> label_counts;
+  int total_number_of_posts = 0;
+
+  // posts containing each bucket, overall and per label id
+  std::vector<int> bucket_counts;
+  std::vector<std::vector<int>> label_bucket_counts;
+
+  // label ids by rank, and rows of label scores by rank: the log-priors,
+  // then one row of log-likelihoods per bucket
+  bool prepared = false;
+  std::vector<int> label_order;
+  std::vector<double> rows;
+
+  // used by training and by compute_most_probable_tag
+  PredictionScratch scratch;
+
+  // MODIFIES: work
+  // EFFECTS : Sets work.buckets to the distinct buckets of the runs of 1
+  //           to order whitespace delimited words of content.
+  void find_buckets(std::string_view content,
+                    PredictionScratch &work) const {
+    std::vector<int> &buckets = work.buckets;
+    buckets.clear();
+    for (const Tokenizer::NGram &gram :
+           work.tokenizer.ngrams(content, order)) {
+      buckets.push_back(int(gram.hash & mask));
+    }
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()),
+                  buckets.end());
+  }
+};
+
+#endif // HASHEDCLASSIFIER_HPP
@@ -0,0 +1,78 @@
+#include "HashedClassifier.hpp"
+#include "test_posts.hpp"
+#include "unit_test_framework.hpp"
+#include <string>
+
+using namespace std;
+
+TEST(hashed_matches_exact_without_collisions) {
+  Classifier exact;
+  HashedClassifier hashed(20);
+  for (auto &post : POSTS) {
+    exact.train_model(post.first, post.second);
+    hashed.train_model(post.first, post.second);
+  }
+  vector<string> queries = {"the dealer left the card", "rotate image",
+                            "unseen words only", ""};
+  for (auto &post : POSTS) {
+    queries.push_back(post.second);
+  }
+  for (auto &query : queries) {
+    auto expected = exact.compute_most_probable_tag(query);
+    auto actual = hashed.compute_most_probable_tag(query);
+    ASSERT_EQUAL(actual.first, expected.first);
+    ASSERT_ALMOST_EQUAL(actual.second, expected.second, 1e-9);
+  }
+}
+
+TEST(hashed_memory_does_not_grow_with_vocabulary) {
+  HashedClassifier hashed(10);
+  hashed.train_model("a", "first");
+  hashed.train_model("b", "second");
+  size_t bytes = hashed.memory_bytes();
+  for (int i = 0; i < 5000; ++i) {
+    hashed.train_model(i % 2 ? "a" : "b", "word" + to_string(i));
+  }
+  ASSERT_EQUAL(hashed.memory_bytes(), bytes);
+  ASSERT_EQUAL(hashed.num_buckets(), 1024u);
+  ASSERT_EQUAL(hashed.total_posts(), 5002);
+}
+
+TEST(hashed_colliding_words_count_once_per_post) {
+  // with one bucket every word collides, so every non-empty post is the
+  // same feature and only the priors tell labels apart
+  HashedClassifier hashed(0);
+  hashed.train_model("calculator", "stack");
+  hashed.train_model("euchre", "card");
+  hashed.train_model("euchre", "bower left");
+  auto prediction = hashed.compute_most_probable_tag("stack stack rational");
+  ASSERT_EQUAL(prediction.first, "euchre");
+  ASSERT_ALMOST_EQUAL(prediction.second, log(2.0 / 3) + log(2.0 / 2), 1e-12);
+
+  // ties go to the first label in sorted order
+  HashedClassifier tied(0);
+  tied.train_model("zebra", "x");
+  tied.train_model("apple", "y");
+  ASSERT_EQUAL(tied.compute_most_probable_tag("z").first, "apple");
+}
+
+TEST(hashed_bigrams_tell_word_order_apart) {
+  // the same words in another order are the same unigram features, but
+  // not the same bigrams
+  HashedClassifier unigrams(20);
+  HashedClassifier bigrams(20, 2);
+  ASSERT_EQUAL(bigrams.ngram_order(), 2);
+  for (HashedClassifier *hashed : {&unigrams, &bigrams}) {
+    hashed->train_model("euchre", "left bower");
+    hashed->train_model("euchre", "left bower");
+    hashed->train_model("calculator", "bower left");
+  }
+  ASSERT_EQUAL(unigrams.compute_most_probable_tag("bower left").first,
+               "euchre");
+  ASSERT_EQUAL(bigrams.compute_most_probable_tag("bower left").first,
+               "calculator");
+  ASSERT_EQUAL(bigrams.compute_most_probable_tag("left bower").first,
+               "euchre");
+}
+
+TEST_MAIN()
@@ -0,0 +1,103 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+/* Interner.hpp
+ *
+ * Assigns dense integer ids 0, 1, 2, ... to strings in order of first
+ * appearance, and maps ids back to strings. Lookups take a string_view and
+ * never allocate. Dictionary is the associative container from string_view
+ * to id: anything with find, end and insert of a (key, id) pair, such as
+ * std::unordered_map, std::map or the project's Map.
+ *
+ * The keys of the dictionary view the interner's own strings, so a copy
+ * builds its dictionary again over its copied strings rather than copying
+ * views into the original's.
+ */
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+template <typename Dictionary =
+            std::unordered_map<std::string_view, int>>
+class Interner {
+public:
+  Interner() = default;
+
+  Interner(const Interner &other) : names(other.names) {
+    index_names();
+  }
+
+  Interner & operator=(const Interner &other) {
+    if (this != &other) {
+      names = other.names;
+      ids = Dictionary();
+      index_names();
+    }
+    return *this;
+  }
+
+  // Moving a deque keeps its strings where they are, so the moved keys
+  // still view them
+  Interner(Interner &&other) = default;
+  Interner & operator=(Interner &&other) = default;
+
+  // EFFECTS : Returns the id of str, assigning the next id if str is new.
+  int intern(std::string_view str) {
+    auto it = ids.find(str);
+    if (it != ids.end()) {
+      return it->second;
+    }
+    int id = names.size();
+    names.emplace_back(str);
+    ids.insert({std::string_view(names.back()), id});
+    return id;
+  }
+
+  // EFFECTS : Returns the id of str, or -1 if str has no id.
+  int find(std::string_view str) const {
+    auto it = ids.find(str);
+    return it == ids.end() ? -1 : it->second;
+  }
+
+  // REQUIRES: 0 <= id < size()
+  // EFFECTS : Returns the string with this id.
+  const std::string & name(int id) const {
+    return names[id];
+  }
+
+  // EFFECTS : Returns the number of strings with ids.
+  int size() const {
+    return names.size();
+  }
+
+  // EFFECTS : Returns every id, ordered by name.
+  std::vector<int> sorted_ids() const {
+    std::vector<int> sorted(names.size());
+    for (int id = 0; id < size(); ++id) {
+      sorted[id] = id;
+    }
+    std::sort(sorted.begin(), sorted.end(), [this](int a, int b) {
+      return names[a] < names[b];
+    });
+    return sorted;
+  }
+
+private:
+  // Keys are views into names. A deque never moves its elements, so the
+  // views stay valid as names grows.
+  Dictionary ids;
+  std::deque<std::string> names;
+
+  // MODIFIES: ids
+  // EFFECTS : Adds every name to ids under its index.
+  void index_names() {
+    for (int id = 0; id < size(); ++id) {
+      ids.insert({std::string_view(names[id]), id});
+    }
+  }
+};
+
+#endif // INTERNER_HPP
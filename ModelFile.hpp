@@ -0,0 +1,606 @@
+#ifndef MODELFILE_HPP
+#define MODELFILE_HPP
+/* ModelFile.hpp
+ *
+ * A trained classifier's scoring tables, laid out so that they can be
+ * written to a binary file, mmap'd and scored in place. The same tables are
+ * also built in memory to score a classifier that was just trained. Labels
+ * and words are stored sorted by name, so a label or word index is also its
+ * rank. Log-priors and log-likelihoods are computed once when the file is
+ * written, with the same expressions the Classifier uses, so scores from a
+ * loaded model match bit for bit. The mapping is read-only and shared, so
+ * processes that load the same file share its pages.
+ *
+ * A quantized model stores its log-likelihoods as dense rows of one or two
+ * bytes per (word, label), see QuantizedRows, in place of the fallback and
+ * entry log-likelihoods. Those two tables are then computed from the counts
+ * when they are asked for, with the same expressions, so a quantized model
+ * scored from its mapping never holds the doubles.
+ *
+ * File layout. Integers are native-endian; every section starts on an
+ * 8-byte boundary.
+ *
+ *   header    magic "P5MODEL\0", uint32 version, uint32 quantization
+ *             (ModelQuantization), uint64 total posts, labels, words,
+ *             entries and hash slots, double unknown-word log-likelihood,
+ *             uint64 offset of each section
+ *   labels    name offsets (uint64, labels + 1), name bytes,
+ *             post counts (int32), log-priors (double)
+ *   words     name offsets (uint64, words + 1), name bytes,
+ *             post counts (int32), log-likelihood when seen without the
+ *             label (double, empty if quantized), first entry of each word
+ *             (uint64, words + 1)
+ *   entries   one per (label, word) with a nonzero count, grouped by word
+ *             and sorted by label: label (uint32), count (int32),
+ *             log-likelihood (double, empty if quantized)
+ *   hash      open-addressing table of word index + 1 (uint32, 0 empty),
+ *             keyed by the FNV-1a hash of the word
+ *   quantized empty unless quantized: offset and scale of each label
+ *             (double), then the unknown-word row and one row per word of
+ *             one value per label (int8 or fp16 bits)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Thrown when a model file cannot be read or written
+class ModelFileError : public std::runtime_error {
+public:
+  explicit ModelFileError(const std::string &msg)
+    : std::runtime_error(msg) {}
+};
+
+// The counts of a trained classifier, with labels and words sorted by name
+struct ModelData {
+  uint64_t total_posts = 0;
+  std::vector<std::string_view> label_names;
+  std::vector<int> label_counts;
+  std::vector<std::string_view> word_names;
+  std::vector<int> word_counts;
+
+  // Entries entry_starts[w] up to entry_starts[w + 1] hold the labels, in
+  // increasing order, that word w was seen with
+  std::vector<uint64_t> entry_starts;
+  std::vector<uint32_t> entry_labels;
+  std::vector<int> entry_counts;
+};
+
+// How a model file stores the log-likelihoods that scoring reads
+enum ModelQuantization : uint32_t {
+  NOT_QUANTIZED, QUANTIZED_INT8, QUANTIZED_FP16
+};
+
+// Quantized log-likelihood rows to store in a model file, see QuantizedRows
+struct QuantizedData {
+  ModelQuantization format = NOT_QUANTIZED;
+  std::vector<double> offsets;
+  std::vector<double> scales;
+
+  // the unknown-word row, then one row per word, in format
+  std::vector<int8_t> bytes;
+  std::vector<uint16_t> halves;
+};
+
+class ModelFile {
+public:
+  static constexpr uint32_t VERSION = 2;
+
+  // EFFECTS : Maps filename read-only and checks its layout. Throws
+  //           ModelFileError if it is missing, malformed or written by
+  //           another version.
+  explicit ModelFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw ModelFileError("Error opening model: " + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+      close(fd);
+      throw ModelFileError("Not a model file: " + filename);
+    }
+    map_size = st.st_size;
+    void *base = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      throw ModelFileError("Error mapping model: " + filename);
+    }
+    map_base = static_cast<const char *>(base);
+    if (!attach()) {
+      munmap(base, map_size);
+      throw ModelFileError("Not a model file: " + filename);
+    }
+  }
+
+  // REQUIRES: data describes a classifier trained on at least one post
+  // EFFECTS : Builds the tables for data in memory.
+  explicit ModelFile(const ModelData &data) {
+    std::string image = build_image(data, QuantizedData());
+    // uint64_t storage keeps every section 8-byte aligned
+    owned.resize(image.size() / sizeof(uint64_t));
+    std::memcpy(owned.data(), image.data(), image.size());
+    map_base = reinterpret_cast<const char *>(owned.data());
+    map_size = image.size();
+    attach();
+  }
+
+  // EFFECTS : Unmaps the file, if this model was loaded from one.
+  ~ModelFile() {
+    if (owned.empty()) {
+      munmap(const_cast<char *>(map_base), map_size);
+    }
+  }
+
+  ModelFile(const ModelFile &) = delete;
+  ModelFile & operator=(const ModelFile &) = delete;
+
+  // REQUIRES: data describes a classifier trained on at least one post,
+  //           quantized is NOT_QUANTIZED or holds a row per word of data
+  //           and the unknown-word row
+  // EFFECTS : Writes data to filename, with the log-likelihoods of
+  //           quantized if it is quantized, through a temporary file so
+  //           that readers never see a partial model. Throws
+  //           ModelFileError if the file cannot be written.
+  static void write(const std::string &filename, const ModelData &data,
+                    const QuantizedData &quantized = QuantizedData()) {
+    std::string image = build_image(data, quantized);
+    write_bytes(filename, image.data(), image.size());
+  }
+
+  // EFFECTS : Writes this model to filename.
+  void save(const std::string &filename) const {
+    write_bytes(filename, map_base, map_size);
+  }
+
+  // EFFECTS : Returns the counts of this model, as views into it.
+  ModelData data() const {
+    ModelData data;
+    data.total_posts = total_posts();
+    for (int label = 0; label < num_labels(); ++label) {
+      data.label_names.push_back(label_name(label));
+      data.label_counts.push_back(label_count(label));
+    }
+    for (int word = 0; word < num_words(); ++word) {
+      data.word_names.push_back(word_name(word));
+      data.word_counts.push_back(word_count(word));
+    }
+    data.entry_starts.assign(entry_starts, entry_starts + num_words() + 1);
+    data.entry_labels.assign(entry_labels, entry_labels + header->num_entries);
+    data.entry_counts.assign(entry_counts, entry_counts + header->num_entries);
+    return data;
+  }
+
+  uint64_t total_posts() const { return header->total_posts; }
+  int num_labels() const { return header->num_labels; }
+  int num_words() const { return header->num_words; }
+
+  // REQUIRES: 0 <= label < num_labels()
+  std::string_view label_name(int label) const {
+    return name(label_name_offsets, label_names, label);
+  }
+  int label_count(int label) const { return label_counts[label]; }
+  double log_prior(int label) const { return log_priors[label]; }
+
+  // REQUIRES: 0 <= word < num_words()
+  std::string_view word_name(int word) const {
+    return name(word_name_offsets, word_names, word);
+  }
+  int word_count(int word) const { return word_counts[word]; }
+
+  // EFFECTS : Returns the index of word, or -1 if it was never seen.
+  int find(std::string_view word) const {
+    uint64_t mask = header->hash_slots - 1;
+    for (uint64_t i = hash(word) & mask; ; i = (i + 1) & mask) {
+      uint32_t slot = hash_slots[i];
+      if (slot == 0) {
+        return -1;
+      }
+      if (word_name(slot - 1) == word) {
+        return slot - 1;
+      }
+    }
+  }
+
+  // EFFECTS : Returns the log-likelihood of a word never seen in training.
+  double unknown_log_likelihood() const {
+    return header->unknown_log_likelihood;
+  }
+
+  // REQUIRES: 0 <= word < num_words()
+  // EFFECTS : Returns the log-likelihood of word for a label it was never
+  //           seen with.
+  double fallback_log_likelihood(int word) const {
+    if (!word_fallbacks) {
+      double n1 = word_counts[word];
+      return std::log(n1 / double(header->total_posts));
+    }
+    return word_fallbacks[word];
+  }
+
+  // REQUIRES: 0 <= label < num_labels(), word < num_words()
+  // EFFECTS : Returns the log-likelihood of word given label, where word
+  //           is -1 for a word never seen in training.
+  double log_likelihood(int label, int word) const {
+    if (word < 0) {
+      return unknown_log_likelihood();
+    }
+    const uint32_t *first = entry_labels + entry_starts[word];
+    const uint32_t *last = entry_labels + entry_starts[word + 1];
+    const uint32_t *it = std::lower_bound(first, last, uint32_t(label));
+    if (it != last && *it == uint32_t(label)) {
+      return entry_log_likelihood(it - entry_labels);
+    }
+    return fallback_log_likelihood(word);
+  }
+
+  // REQUIRES: 0 <= word < num_words()
+  // EFFECTS : Returns the range of entries for word.
+  uint64_t entries_begin(int word) const { return entry_starts[word]; }
+  uint64_t entries_end(int word) const { return entry_starts[word + 1]; }
+
+  // REQUIRES: 0 <= entry < entries_end(num_words() - 1)
+  int entry_label(uint64_t entry) const { return entry_labels[entry]; }
+  int entry_count(uint64_t entry) const { return entry_counts[entry]; }
+  double entry_log_likelihood(uint64_t entry) const {
+    if (!entry_log_likelihoods) {
+      double n1 = entry_counts[entry];
+      return std::log(n1 / label_counts[entry_labels[entry]]);
+    }
+    return entry_log_likelihoods[entry];
+  }
+
+  // EFFECTS : Returns how the log-likelihoods are stored.
+  ModelQuantization quantization() const {
+    return ModelQuantization(header->quantization);
+  }
+
+  // REQUIRES: quantization() != NOT_QUANTIZED, 0 <= label < num_labels()
+  // EFFECTS : Returns the offset and scale of the quantized values of
+  //           label.
+  double quantized_offset(int label) const { return quantized_ranges[label]; }
+  double quantized_scale(int label) const {
+    return quantized_ranges[header->num_labels + label];
+  }
+
+  // REQUIRES: quantization() is QUANTIZED_INT8, or QUANTIZED_FP16 for
+  //           quantized_halves
+  // EFFECTS : Returns the quantized unknown-word row, followed by one row
+  //           per word.
+  const int8_t * quantized_bytes() const {
+    return reinterpret_cast<const int8_t *>(quantized_values);
+  }
+  const uint16_t * quantized_halves() const {
+    return reinterpret_cast<const uint16_t *>(quantized_values);
+  }
+
+private:
+  enum Section {
+    LABEL_NAME_OFFSETS, LABEL_NAMES, LABEL_COUNTS, LOG_PRIORS,
+    WORD_NAME_OFFSETS, WORD_NAMES, WORD_COUNTS, WORD_FALLBACKS,
+    ENTRY_STARTS, ENTRY_LABELS, ENTRY_COUNTS, ENTRY_LOG_LIKELIHOODS,
+    HASH_SLOTS, QUANTIZED_RANGES, QUANTIZED_VALUES, NUM_SECTIONS
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t quantization;
+    uint64_t total_posts;
+    uint64_t num_labels;
+    uint64_t num_words;
+    uint64_t num_entries;
+    uint64_t hash_slots;
+    double unknown_log_likelihood;
+    uint64_t sections[NUM_SECTIONS];
+  };
+
+  const char *map_base = nullptr;
+  size_t map_size = 0;
+
+  // The image of a model built in memory, empty for a mapped file
+  std::vector<uint64_t> owned;
+
+  const Header *header = nullptr;
+  const uint64_t *label_name_offsets = nullptr;
+  const char *label_names = nullptr;
+  const int32_t *label_counts = nullptr;
+  const double *log_priors = nullptr;
+  const uint64_t *word_name_offsets = nullptr;
+  const char *word_names = nullptr;
+  const int32_t *word_counts = nullptr;
+  const double *word_fallbacks = nullptr;
+  const uint64_t *entry_starts = nullptr;
+  const uint32_t *entry_labels = nullptr;
+  const int32_t *entry_counts = nullptr;
+  const double *entry_log_likelihoods = nullptr;
+  const uint32_t *hash_slots = nullptr;
+
+  // null unless quantized: offsets then scales, and the rows
+  const double *quantized_ranges = nullptr;
+  const char *quantized_values = nullptr;
+
+  static std::string_view name(const uint64_t *offsets, const char *names,
+                               int i) {
+    return std::string_view(names + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+
+  // EFFECTS : Returns the 64-bit FNV-1a hash of word.
+  static uint64_t hash(std::string_view word) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : word) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  static uint64_t align(uint64_t size) {
+    return (size + 7) & ~uint64_t(7);
+  }
+
+  // MODIFIES: image
+  // EFFECTS : Appends the bytes of values to image, padded to 8 bytes,
+  //           and returns where they start.
+  template <typename T>
+  static uint64_t append(std::string &image, const std::vector<T> &values) {
+    uint64_t start = image.size();
+    image.append(reinterpret_cast<const char *>(values.data()),
+                 values.size() * sizeof(T));
+    image.resize(align(image.size()), '\0');
+    return start;
+  }
+
+  // MODIFIES: image
+  // EFFECTS : Appends the offsets of names, then their bytes, and records
+  //           where each section starts.
+  static void append_names(std::string &image,
+                           const std::vector<std::string_view> &names,
+                           uint64_t &offsets_section,
+                           uint64_t &names_section) {
+    std::vector<uint64_t> offsets(1, 0);
+    std::string bytes;
+    for (std::string_view name : names) {
+      bytes += name;
+      offsets.push_back(bytes.size());
+    }
+    offsets_section = append(image, offsets);
+    names_section = image.size();
+    image += bytes;
+    image.resize(align(image.size()), '\0');
+  }
+
+  // EFFECTS : Returns a hash table of word index + 1 with at least twice
+  //           as many slots as words.
+  static std::vector<uint32_t> build_hash(
+    const std::vector<std::string_view> &words) {
+    size_t size = 1;
+    while (size < 2 * words.size()) {
+      size *= 2;
+    }
+    std::vector<uint32_t> slots(size, 0);
+    for (size_t w = 0; w < words.size(); ++w) {
+      size_t i = hash(words[w]) & (size - 1);
+      while (slots[i] != 0) {
+        i = (i + 1) & (size - 1);
+      }
+      slots[i] = w + 1;
+    }
+    return slots;
+  }
+
+  // EFFECTS : Returns the file contents for data, quantized as quantized.
+  static std::string build_image(const ModelData &data,
+                                 const QuantizedData &quantized) {
+    Header head;
+    std::memset(&head, 0, sizeof(head));
+    std::memcpy(head.magic, "P5MODEL", 8);
+    head.version = VERSION;
+    head.quantization = quantized.format;
+    head.total_posts = data.total_posts;
+    head.num_labels = data.label_names.size();
+    head.num_words = data.word_names.size();
+    head.num_entries = data.entry_labels.size();
+    double total = data.total_posts;
+    head.unknown_log_likelihood = std::log(1.0 / total);
+
+    std::vector<double> log_priors;
+    for (int count : data.label_counts) {
+      double n1 = count;
+      log_priors.push_back(std::log(n1 / total));
+    }
+    // a quantized model stores its log-likelihoods in the quantized rows
+    std::vector<double> fallbacks;
+    std::vector<double> log_likelihoods;
+    std::vector<double> ranges;
+    if (quantized.format == NOT_QUANTIZED) {
+      for (int count : data.word_counts) {
+        double n1 = count;
+        fallbacks.push_back(std::log(n1 / total));
+      }
+      for (size_t i = 0; i < data.entry_labels.size(); ++i) {
+        double n1 = data.entry_counts[i];
+        log_likelihoods.push_back(
+          std::log(n1 / data.label_counts[data.entry_labels[i]]));
+      }
+    } else {
+      ranges = quantized.offsets;
+      ranges.insert(ranges.end(), quantized.scales.begin(),
+                    quantized.scales.end());
+    }
+    std::vector<uint32_t> slots = build_hash(data.word_names);
+    head.hash_slots = slots.size();
+
+    std::string image(sizeof(Header), '\0');
+    uint64_t *sections = head.sections;
+    append_names(image, data.label_names, sections[LABEL_NAME_OFFSETS],
+                 sections[LABEL_NAMES]);
+    sections[LABEL_COUNTS] = append(image, data.label_counts);
+    sections[LOG_PRIORS] = append(image, log_priors);
+    append_names(image, data.word_names, sections[WORD_NAME_OFFSETS],
+                 sections[WORD_NAMES]);
+    sections[WORD_COUNTS] = append(image, data.word_counts);
+    sections[WORD_FALLBACKS] = append(image, fallbacks);
+    sections[ENTRY_STARTS] = append(image, data.entry_starts);
+    sections[ENTRY_LABELS] = append(image, data.entry_labels);
+    sections[ENTRY_COUNTS] = append(image, data.entry_counts);
+    sections[ENTRY_LOG_LIKELIHOODS] = append(image, log_likelihoods);
+    sections[HASH_SLOTS] = append(image, slots);
+    sections[QUANTIZED_RANGES] = append(image, ranges);
+    sections[QUANTIZED_VALUES] = quantized.format == QUANTIZED_FP16
+      ? append(image, quantized.halves) : append(image, quantized.bytes);
+    std::memcpy(&image[0], &head, sizeof(head));
+    return image;
+  }
+
+  // EFFECTS : Writes bytes to filename through a temporary file of this
+  //           write only, synced before it is renamed into place, so that
+  //           concurrent writers never mix their images. Throws
+  //           ModelFileError if the file cannot be written.
+  static void write_bytes(const std::string &filename, const char *bytes,
+                          size_t size) {
+    std::string tmp_file = filename + ".XXXXXX";
+    int fd = mkstemp(&tmp_file[0]);
+    if (fd < 0) {
+      throw ModelFileError("Error writing model: " + filename);
+    }
+    bool written = fchmod(fd, 0644) == 0;
+    while (written && size > 0) {
+      ssize_t count = ::write(fd, bytes, size);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        written = false;
+        break;
+      }
+      bytes += count;
+      size -= count;
+    }
+    written = written && fsync(fd) == 0;
+    written = close(fd) == 0 && written;
+    if (!written || std::rename(tmp_file.c_str(), filename.c_str()) != 0) {
+      unlink(tmp_file.c_str());
+      throw ModelFileError("Error writing model: " + filename);
+    }
+  }
+
+  // EFFECTS : Returns a pointer to section, or nullptr if count elements
+  //           of T starting there do not fit in the mapping.
+  template <typename T>
+  const T * section(Section s, uint64_t count) const {
+    uint64_t start = header->sections[s];
+    if (start % 8 != 0 || start > map_size ||
+        count > (map_size - start) / sizeof(T)) {
+      return nullptr;
+    }
+    return reinterpret_cast<const T *>(map_base + start);
+  }
+
+  // EFFECTS : Returns whether offsets[0..count] increase from 0 to at
+  //           most limit.
+  static bool increasing(const uint64_t *offsets, uint64_t count,
+                         uint64_t limit) {
+    if (offsets[0] != 0 || offsets[count] > limit) {
+      return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+      if (offsets[i] > offsets[i + 1]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // EFFECTS : Points the section pointers into the mapping and returns
+  //           whether every section and index lies inside it.
+  bool attach() {
+    header = reinterpret_cast<const Header *>(map_base);
+    if (std::memcmp(header->magic, "P5MODEL", 8) != 0 ||
+        header->version != VERSION ||
+        header->quantization > QUANTIZED_FP16 ||
+        header->num_labels > INT32_MAX ||
+        header->num_words > INT32_MAX || header->hash_slots == 0 ||
+        (header->hash_slots & (header->hash_slots - 1)) != 0 ||
+        header->hash_slots <= header->num_words) {
+      return false;
+    }
+    uint64_t labels = header->num_labels;
+    uint64_t words = header->num_words;
+    uint64_t entries = header->num_entries;
+
+    label_name_offsets = section<uint64_t>(LABEL_NAME_OFFSETS, labels + 1);
+    word_name_offsets = section<uint64_t>(WORD_NAME_OFFSETS, words + 1);
+    entry_starts = section<uint64_t>(ENTRY_STARTS, words + 1);
+    if (!label_name_offsets || !word_name_offsets || !entry_starts) {
+      return false;
+    }
+    label_names = section<char>(LABEL_NAMES, label_name_offsets[labels]);
+    label_counts = section<int32_t>(LABEL_COUNTS, labels);
+    log_priors = section<double>(LOG_PRIORS, labels);
+    word_names = section<char>(WORD_NAMES, word_name_offsets[words]);
+    word_counts = section<int32_t>(WORD_COUNTS, words);
+    // a quantized model holds quantized rows in place of the doubles
+    bool quantized = header->quantization != NOT_QUANTIZED;
+    uint64_t doubles = quantized ? 0 : 1;
+    uint64_t values = quantized ? (words + 1) * labels : 0;
+    word_fallbacks = section<double>(WORD_FALLBACKS, words * doubles);
+    entry_labels = section<uint32_t>(ENTRY_LABELS, entries);
+    entry_counts = section<int32_t>(ENTRY_COUNTS, entries);
+    entry_log_likelihoods =
+      section<double>(ENTRY_LOG_LIKELIHOODS, entries * doubles);
+    hash_slots = section<uint32_t>(HASH_SLOTS, header->hash_slots);
+    quantized_ranges =
+      section<double>(QUANTIZED_RANGES, quantized ? 2 * labels : 0);
+    quantized_values = header->quantization == QUANTIZED_FP16
+      ? section<char>(QUANTIZED_VALUES, values * sizeof(uint16_t))
+      : section<char>(QUANTIZED_VALUES, values);
+    if (!label_names || !label_counts || !log_priors || !word_names ||
+        !word_counts || !word_fallbacks || !entry_labels || !entry_counts ||
+        !entry_log_likelihoods || !hash_slots || !quantized_ranges ||
+        !quantized_values ||
+        !increasing(label_name_offsets, labels, map_size) ||
+        !increasing(word_name_offsets, words, map_size) ||
+        !increasing(entry_starts, words, entries) ||
+        entry_starts[words] != entries) {
+      return false;
+    }
+    if (quantized) {
+      word_fallbacks = nullptr;
+      entry_log_likelihoods = nullptr;
+    } else {
+      quantized_ranges = nullptr;
+      quantized_values = nullptr;
+    }
+    return indexes_valid();
+  }
+
+  // EFFECTS : Returns whether every entry label and hash slot names an
+  //           existing label or word.
+  bool indexes_valid() const {
+    for (uint64_t i = 0; i < header->num_entries; ++i) {
+      if (entry_labels[i] >= header->num_labels) {
+        return false;
+      }
+    }
+    for (uint64_t i = 0; i < header->hash_slots; ++i) {
+      if (hash_slots[i] > header->num_words) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif // MODELFILE_HPP
@@ -0,0 +1,175 @@
+#include "ModelFile.hpp"
+#include "test_model.hpp"
+#include "unit_test_framework.hpp"
+#include <cmath>
+#include <dirent.h>
+#include <fstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const string MODEL = "/tmp/ModelFile_tests.model";
+
+// EFFECTS overwrite size bytes of filename at offset with value
+static void patch(const string &filename, size_t offset, const void *value,
+                  size_t size) {
+  fstream file(filename.c_str(), ios::binary | ios::in | ios::out);
+  file.seekp(offset);
+  file.write(static_cast<const char *>(value), size);
+}
+
+// EFFECTS return whether opening filename throws ModelFileError
+static bool rejected(const string &filename) {
+  try {
+    ModelFile model(filename);
+  } catch (const ModelFileError &) {
+    return true;
+  }
+  return false;
+}
+
+TEST(model_round_trip) {
+  ModelFile::write(MODEL, small_model());
+  ModelFile model(MODEL);
+
+  ASSERT_EQUAL(model.total_posts(), 4u);
+  ASSERT_EQUAL(model.num_labels(), 2);
+  ASSERT_EQUAL(model.num_words(), 2);
+  ASSERT_EQUAL(model.label_name(1), "euchre");
+  ASSERT_EQUAL(model.label_count(0), 2);
+  ASSERT_EQUAL(model.log_prior(0), log(2.0 / 4));
+  ASSERT_EQUAL(model.word_name(0), "card");
+  ASSERT_EQUAL(model.word_count(1), 3);
+  ASSERT_EQUAL(model.unknown_log_likelihood(), log(1.0 / 4));
+  ASSERT_EQUAL(model.fallback_log_likelihood(0), log(2.0 / 4));
+
+  ASSERT_EQUAL(model.entries_begin(1), 1u);
+  ASSERT_EQUAL(model.entries_end(1), 3u);
+  ASSERT_EQUAL(model.entry_label(2), 1);
+  ASSERT_EQUAL(model.entry_count(2), 1);
+  ASSERT_EQUAL(model.entry_log_likelihood(2), log(1.0 / 2));
+}
+
+TEST(model_find) {
+  ModelFile::write(MODEL, small_model());
+  ModelFile model(MODEL);
+  ASSERT_EQUAL(model.find("card"), 0);
+  ASSERT_EQUAL(model.find("stack"), 1);
+  ASSERT_EQUAL(model.find("bower"), -1);
+  ASSERT_EQUAL(model.find(""), -1);
+}
+
+TEST(model_save_copies) {
+  ModelFile::write(MODEL, small_model());
+  ModelFile model(MODEL);
+  model.save(MODEL + ".copy");
+  ModelFile copy(MODEL + ".copy");
+  ASSERT_EQUAL(copy.find("stack"), 1);
+  ASSERT_EQUAL(copy.entry_log_likelihood(0), model.entry_log_likelihood(0));
+  remove((MODEL + ".copy").c_str());
+}
+
+TEST(model_quantized_round_trip) {
+  ModelFile exact(small_model());
+  QuantizedData quantized;
+  quantized.format = QUANTIZED_INT8;
+  quantized.offsets = {-1.0, -2.0};
+  quantized.scales = {0.5, 0.25};
+  quantized.bytes = {1, 2, 3, 4, 5, 6};
+  ModelFile::write(MODEL, small_model(), quantized);
+  ModelFile model(MODEL);
+
+  ASSERT_EQUAL(model.quantization(), QUANTIZED_INT8);
+  ASSERT_EQUAL(model.quantized_offset(1), -2.0);
+  ASSERT_EQUAL(model.quantized_scale(0), 0.5);
+  ASSERT_EQUAL(model.quantized_bytes()[5], 6);
+  ASSERT_EQUAL(model.find("stack"), 1);
+
+  // the double tables are not stored, and come out of the counts the same
+  for (int word = 0; word < model.num_words(); ++word) {
+    ASSERT_EQUAL(model.fallback_log_likelihood(word),
+                 exact.fallback_log_likelihood(word));
+    for (int label = 0; label < model.num_labels(); ++label) {
+      ASSERT_EQUAL(model.log_likelihood(label, word),
+                   exact.log_likelihood(label, word));
+    }
+  }
+  ASSERT_EQUAL(model.entry_log_likelihood(2), exact.entry_log_likelihood(2));
+
+  // the counts round trip, without the quantized rows
+  ModelFile::write(MODEL + ".copy", model.data());
+  ModelFile copy(MODEL + ".copy");
+  ASSERT_EQUAL(copy.quantization(), NOT_QUANTIZED);
+  ASSERT_EQUAL(copy.entry_log_likelihood(1), exact.entry_log_likelihood(1));
+  remove((MODEL + ".copy").c_str());
+}
+
+TEST(model_concurrent_writers_never_mix) {
+  // two processes save different models to one path at once; whichever
+  // rename lands last, the file is one whole model
+  ModelData other = small_model();
+  other.total_posts = 8;
+  pid_t child = fork();
+  for (int i = 0; i < 200; ++i) {
+    ModelFile::write(MODEL, child == 0 ? other : small_model());
+  }
+  if (child == 0) {
+    _exit(0);
+  }
+  int status;
+  waitpid(child, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  ModelFile model(MODEL);
+  ASSERT_TRUE(model.total_posts() == 4u || model.total_posts() == 8u);
+
+  // and no temporary file is left behind
+  DIR *dir = opendir("/tmp");
+  string prefix = MODEL.substr(5) + ".";
+  int temporaries = 0;
+  while (dirent *entry = readdir(dir)) {
+    string name = entry->d_name;
+    temporaries += name.compare(0, prefix.size(), prefix) == 0;
+  }
+  closedir(dir);
+  ASSERT_EQUAL(temporaries, 0);
+}
+
+TEST(model_rejects_missing_file) {
+  remove(MODEL.c_str());
+  ASSERT_TRUE(rejected(MODEL));
+}
+
+TEST(model_rejects_other_version) {
+  ModelFile::write(MODEL, small_model());
+  uint32_t version = ModelFile::VERSION + 1;
+  patch(MODEL, 8, &version, sizeof(version));
+  ASSERT_TRUE(rejected(MODEL));
+}
+
+TEST(model_rejects_unknown_quantization) {
+  ModelFile::write(MODEL, small_model());
+  uint32_t quantization = QUANTIZED_FP16 + 1;
+  patch(MODEL, 12, &quantization, sizeof(quantization));
+  ASSERT_TRUE(rejected(MODEL));
+}
+
+TEST(model_rejects_bad_magic) {
+  ModelFile::write(MODEL, small_model());
+  patch(MODEL, 0, "P5CSVC", 6);
+  ASSERT_TRUE(rejected(MODEL));
+}
+
+TEST(model_rejects_truncated_file) {
+  ModelFile::write(MODEL, small_model());
+  ifstream fin(MODEL.c_str(), ios::binary);
+  string bytes((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+  fin.close();
+  ofstream fout(MODEL.c_str(), ios::binary | ios::trunc);
+  fout.write(bytes.data(), bytes.size() - 16);
+  fout.close();
+  ASSERT_TRUE(rejected(MODEL));
+}
+
+TEST_MAIN()
@@ -0,0 +1,144 @@
+#ifndef MODELHANDLE_HPP
+#define MODELHANDLE_HPP
+/* ModelHandle.hpp
+ *
+ * The classifier that a running predictor uses, replaceable while it runs.
+ * Predictors take a snapshot, a reference-counted pointer to the current
+ * version, and predict from it; publishing a new version swaps the pointer
+ * atomically, so later snapshots see the new classifier while predictions
+ * in flight finish on the old one, which is freed with its last snapshot.
+ *
+ * A reload builds the next classifier on a background thread and publishes
+ * it when it is ready, so prediction never waits for training. Reloads can
+ * be requested by a call, or by a signal such as SIGHUP.
+ */
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include "Classifier.hpp"
+
+class ModelHandle {
+public:
+  // Builds a classifier, for example by training it or loading a model
+  using Builder = std::function<std::unique_ptr<Classifier>()>;
+
+  // A published classifier, ready to predict from on any thread
+  struct Version {
+    std::unique_ptr<const Classifier> classifier;
+
+    // 1 for the first version, then increasing by one per publish
+    uint64_t number;
+  };
+
+  // MODIFIES: cerr
+  // EFFECTS : Builds and publishes the first version with build, which is
+  //           also used by every reload. Reloads that throw are reported
+  //           to cerr and keep the current version.
+  explicit ModelHandle(Builder build)
+    : build(std::move(build)) {
+    publish(this->build());
+  }
+
+  // EFFECTS : Stops reloading on a signal, and waits for a reload in
+  //           progress.
+  ~ModelHandle() {
+    if (signal_thread.joinable()) {
+      stopping = true;
+      pthread_kill(signal_thread.native_handle(), reload_signal);
+      signal_thread.join();
+    }
+    std::lock_guard<std::mutex> lock(reload_mutex);
+    if (reloader.joinable()) {
+      reloader.join();
+    }
+  }
+
+  ModelHandle(const ModelHandle &) = delete;
+  ModelHandle & operator=(const ModelHandle &) = delete;
+
+  // EFFECTS : Returns the current version. It stays valid while the
+  //           returned pointer is held, whatever is published meanwhile.
+  std::shared_ptr<const Version> snapshot() const {
+    return std::atomic_load(&current);
+  }
+
+  // MODIFIES: this, classifier
+  // EFFECTS : Prepares classifier for prediction and makes it the current
+  //           version.
+  void publish(std::unique_ptr<Classifier> classifier) {
+    classifier->prepare_prediction();
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    auto next = std::make_shared<Version>();
+    next->classifier = std::move(classifier);
+    next->number = current ? current->number + 1 : 1;
+    std::atomic_store(&current, std::shared_ptr<const Version>(next));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Starts building and publishing a new version in the
+  //           background, and returns true, unless a reload is already in
+  //           progress, in which case it returns false.
+  bool reload() {
+    std::lock_guard<std::mutex> lock(reload_mutex);
+    if (reloading) {
+      return false;
+    }
+    if (reloader.joinable()) {
+      reloader.join();
+    }
+    reloading = true;
+    reloader = std::thread([this]() {
+      try {
+        publish(build());
+      } catch (const std::exception &error) {
+        std::cerr << "Reload failed, keeping the current model: "
+                  << error.what() << std::endl;
+      }
+      reloading = false;
+    });
+    return true;
+  }
+
+  // REQUIRES: no other thread is running, called at most once
+  // MODIFIES: this, the signal mask of this thread
+  // EFFECTS : Reloads whenever the process receives signal. The signal is
+  //           blocked in this thread and in the threads it starts later,
+  //           and waited for on a thread of its own.
+  void reload_on_signal(int signal) {
+    reload_signal = signal;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signal);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal_thread = std::thread([this, signals]() {
+      int received;
+      while (sigwait(&signals, &received) == 0 && !stopping) {
+        reload();
+      }
+    });
+  }
+
+private:
+  Builder build;
+  std::shared_ptr<const Version> current;
+  std::mutex publish_mutex;
+
+  // the background reload, if any
+  std::mutex reload_mutex;
+  std::thread reloader;
+  std::atomic<bool> reloading{false};
+
+  int reload_signal = 0;
+  std::thread signal_thread;
+  std::atomic<bool> stopping{false};
+};
+
+#endif // MODELHANDLE_HPP
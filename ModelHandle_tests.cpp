@@ -0,0 +1,111 @@
+#include "ModelHandle.hpp"
+#include "test_posts.hpp"
+#include "unit_test_framework.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+static const string QUERY = "the dealer rotate the card";
+
+// EFFECTS return a builder that alternates between two models, the first
+//         one for odd versions and the second one for even versions
+static ModelHandle::Builder alternating() {
+  auto builds = make_shared<atomic<int>>(0);
+  return [builds]() {
+    return trained((*builds)++ % 2 ? "new-" : "");
+  };
+}
+
+// EFFECTS wait up to a few seconds until models publishes version, and
+//         return whether it did
+static bool wait_for(const ModelHandle &models, uint64_t version) {
+  for (int i = 0; i < 5000 && models.snapshot()->number < version; ++i) {
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  return models.snapshot()->number >= version;
+}
+
+TEST(model_handle_publishes_new_versions) {
+  ModelHandle models(alternating());
+  auto first = models.snapshot();
+  ASSERT_EQUAL(first->number, 1u);
+  ASSERT_TRUE(models.reload());
+  ASSERT_TRUE(wait_for(models, 2));
+
+  // the old snapshot still predicts from the old model
+  PredictionScratch work;
+  ASSERT_EQUAL(first->classifier->predict(QUERY, work).first, "euchre");
+  auto second = models.snapshot();
+  ASSERT_EQUAL(second->classifier->predict(QUERY, work).first,
+               "new-euchre");
+}
+
+TEST(model_handle_keeps_version_when_reload_fails) {
+  auto builds = make_shared<int>(0);
+  ModelHandle models([builds]() {
+    if ((*builds)++ > 0) {
+      throw ModelFileError("no model");
+    }
+    return trained();
+  });
+  ASSERT_TRUE(models.reload());
+
+  // a second reload starts once the failed one has finished
+  while (!models.reload()) {
+    this_thread::yield();
+  }
+  ASSERT_EQUAL(models.snapshot()->number, 1u);
+}
+
+TEST(model_handle_stress_reload_while_predicting) {
+  const uint64_t RELOADS = 100;
+  ModelHandle models(alternating());
+  auto old_result = trained()->compute_most_probable_tag(QUERY);
+  auto new_result = trained("new-")->compute_most_probable_tag(QUERY);
+
+  atomic<bool> done(false);
+  atomic<int> failures(0);
+  atomic<long> predictions(0);
+  vector<thread> predictors;
+  for (int t = 0; t < 4; ++t) {
+    predictors.emplace_back([&]() {
+      PredictionScratch scratch;
+      uint64_t last = 0;
+      while (!done) {
+        auto model = models.snapshot();
+        auto result = model->classifier->predict(QUERY, scratch);
+        auto &expected = model->number % 2 ? old_result : new_result;
+        failures += result != expected || model->number < last;
+        last = model->number;
+        predictions++;
+      }
+    });
+  }
+
+  for (uint64_t version = 2; version <= RELOADS + 1; ++version) {
+    while (!models.reload()) {
+      this_thread::yield();
+    }
+    ASSERT_TRUE(wait_for(models, version));
+  }
+  done = true;
+  for (auto &predictor : predictors) {
+    predictor.join();
+  }
+  ASSERT_EQUAL(models.snapshot()->number, RELOADS + 1);
+  ASSERT_EQUAL(failures.load(), 0);
+  ASSERT_TRUE(predictions > 0);
+}
+
+TEST(model_handle_reloads_on_signal) {
+  ModelHandle models(alternating());
+  models.reload_on_signal(SIGHUP);
+  kill(getpid(), SIGHUP);
+  ASSERT_TRUE(wait_for(models, 2));
+}
+
+TEST_MAIN()
@@ -0,0 +1,135 @@
+#ifndef OUTPUTWRITER_HPP
+#define OUTPUTWRITER_HPP
+/* OutputWriter.hpp
+ *
+ * Buffered text output for printing many short lines. Text and numbers are
+ * appended to a large buffer that goes to the underlying stream only when
+ * it fills up or on flush(), so lines do not flush one by one. Numbers are
+ * formatted with std::to_chars, and doubles in the general format with the
+ * writer's precision, which prints exactly what an ostream with the same
+ * precision prints (printf's "%.*g"), without going through iostreams.
+ *
+ * A writer without a stream only collects text, for formatting output on
+ * one thread and writing it on another.
+ */
+
+#include <charconv>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+class OutputWriter {
+public:
+  // Buffered bytes that make the writer write them out
+  static const size_t CAPACITY = 1 << 16;
+
+  // EFFECTS : Creates a writer to out, printing doubles with precision
+  //           significant digits.
+  explicit OutputWriter(std::ostream &out, int precision = 3)
+    : out(&out), precision(precision) {
+    buffer.reserve(CAPACITY + MAX_NUMBER);
+  }
+
+  // EFFECTS : Creates a writer that only collects text, see contents().
+  explicit OutputWriter(int precision = 3)
+    : out(nullptr), precision(precision) {}
+
+  // EFFECTS : Writes out what is still buffered.
+  ~OutputWriter() {
+    flush();
+  }
+
+  OutputWriter(const OutputWriter &) = delete;
+  OutputWriter & operator=(const OutputWriter &) = delete;
+
+  // MODIFIES: this
+  // EFFECTS : Appends text.
+  OutputWriter & operator<<(std::string_view text) {
+    buffer.append(text);
+    return spill();
+  }
+
+  OutputWriter & operator<<(const char *text) {
+    return *this << std::string_view(text);
+  }
+
+  OutputWriter & operator<<(const std::string &text) {
+    return *this << std::string_view(text);
+  }
+
+  OutputWriter & operator<<(char c) {
+    buffer.push_back(c);
+    return spill();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Appends value in decimal.
+  template <typename Integer,
+            typename = std::enable_if_t<std::is_integral<Integer>::value>>
+  OutputWriter & operator<<(Integer value) {
+    char digits[MAX_NUMBER];
+    auto result = std::to_chars(digits, digits + MAX_NUMBER, value);
+    buffer.append(digits, result.ptr - digits);
+    return spill();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Appends value with the writer's precision, as "%.*g" does.
+  OutputWriter & operator<<(double value) {
+    char digits[MAX_NUMBER];
+    auto result = std::to_chars(digits, digits + MAX_NUMBER, value,
+                                std::chars_format::general, precision);
+    buffer.append(digits, result.ptr - digits);
+    return spill();
+  }
+
+  // EFFECTS : Returns the significant digits used for doubles.
+  int get_precision() const {
+    return precision;
+  }
+
+  // REQUIRES: the writer has no stream
+  // EFFECTS : Returns the text collected so far.
+  std::string_view contents() const {
+    return buffer;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Discards the text collected so far.
+  void clear() {
+    buffer.clear();
+  }
+
+  // MODIFIES: this, the stream
+  // EFFECTS : Writes the buffer to the stream and flushes the stream.
+  void flush() {
+    if (out) {
+      out->write(buffer.data(), buffer.size());
+      out->flush();
+      buffer.clear();
+    }
+  }
+
+private:
+  // longest formatted number: sign, 17 digits, point and exponent, with
+  // room to spare
+  static const size_t MAX_NUMBER = 64;
+
+  std::ostream *out;
+  int precision;
+  std::string buffer;
+
+  // MODIFIES: this, the stream
+  // EFFECTS : Writes the buffer out once it holds CAPACITY bytes.
+  OutputWriter & spill() {
+    if (out && buffer.size() >= CAPACITY) {
+      out->write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+    return *this;
+  }
+};
+
+#endif // OUTPUTWRITER_HPP
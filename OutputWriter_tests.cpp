@@ -0,0 +1,106 @@
+#include "OutputWriter.hpp"
+#include "unit_test_framework.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// EFFECTS return value printed by printf with precision significant digits
+static string printf_general(double value, int precision) {
+  char text[64];
+  snprintf(text, sizeof(text), "%.*g", precision, value);
+  return text;
+}
+
+// EFFECTS return value printed by an OutputWriter with precision
+static string writer_general(double value, int precision) {
+  OutputWriter writer(precision);
+  writer << value;
+  return string(writer.contents());
+}
+
+TEST(writer_collects_text_and_integers) {
+  OutputWriter writer;
+  string text = "label";
+  writer << "  " << text << ", " << 'x' << string_view("yz") << ' '
+         << 42 << ' ' << -7 << ' ' << size_t(0) << ' '
+         << numeric_limits<int64_t>::min() << ' ' << uint64_t(1) << 63;
+  ASSERT_EQUAL(writer.contents(),
+               "  label, xyz 42 -7 0 -9223372036854775808 163");
+  writer.clear();
+  ASSERT_EQUAL(writer.contents(), "");
+}
+
+TEST(writer_doubles_match_printf) {
+  vector<double> values = {0.0, -0.0, 1.0, -1.0, 0.5, 3.14159, -2.30258509,
+                           10.0, 99.95, 999.5, 1000.0, 12345.678, 1e-5,
+                           1.2345e-4, 0.000999, 1e15, 1e16, -1e100, 5e-324,
+                           numeric_limits<double>::max(),
+                           numeric_limits<double>::min()};
+  // log-probabilities and other values across many magnitudes
+  for (int i = 1; i < 5000; ++i) {
+    values.push_back(log(i / 4999.0) * i);
+    values.push_back(1.0 / i);
+    values.push_back(pow(10.0, (i - 2500) / 97.0));
+  }
+  for (int precision : {1, 3, 6, 17}) {
+    for (double value : values) {
+      ASSERT_EQUAL(writer_general(value, precision),
+                   printf_general(value, precision));
+    }
+  }
+}
+
+TEST(writer_doubles_match_ostream) {
+  ostringstream stream;
+  stream.precision(3);
+  OutputWriter writer;
+  for (int i = -2000; i < 2000; ++i) {
+    double value = i * 0.123456789 - 17.0 / (i + 0.5);
+    stream << value << '\n';
+    writer << value << '\n';
+  }
+  ASSERT_EQUAL(writer.contents(), stream.str());
+}
+
+TEST(writer_special_values) {
+  ASSERT_EQUAL(writer_general(numeric_limits<double>::infinity(), 3),
+               printf_general(numeric_limits<double>::infinity(), 3));
+  ASSERT_EQUAL(writer_general(-numeric_limits<double>::infinity(), 3),
+               printf_general(-numeric_limits<double>::infinity(), 3));
+  ASSERT_EQUAL(writer_general(numeric_limits<double>::quiet_NaN(), 3),
+               printf_general(numeric_limits<double>::quiet_NaN(), 3));
+}
+
+TEST(writer_buffers_until_full_or_flushed) {
+  ostringstream stream;
+  {
+    OutputWriter writer(stream);
+    writer << "first line\n";
+    ASSERT_EQUAL(stream.str(), "");
+    writer.flush();
+    ASSERT_EQUAL(stream.str(), "first line\n");
+
+    string line(99, 'x');
+    line += '\n';
+    size_t written = 0;
+    while (written < OutputWriter::CAPACITY) {
+      writer << line;
+      written += line.size();
+    }
+    // the buffer spilled once it reached capacity, in order
+    ASSERT_EQUAL(stream.str().size(), written + 11);
+    writer << "last line\n";
+  }
+  // the destructor writes what is left
+  string all = stream.str();
+  ASSERT_EQUAL(all.substr(0, 11), "first line\n");
+  ASSERT_EQUAL(all.substr(all.size() - 10), "last line\n");
+}
+
+TEST_MAIN()
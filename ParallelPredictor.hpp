@@ -0,0 +1,202 @@
+#ifndef PARALLELPREDICTOR_HPP
+#define PARALLELPREDICTOR_HPP
+/* ParallelPredictor.hpp
+ *
+ * Predicts test posts on several threads and prints the results in input
+ * order. Added batches are cut into chunks of rows that go on a bounded
+ * work queue, from which a pool of scorers predicts and formats them, each
+ * with its own tokenizer and score buffer. A future for every chunk goes
+ * on a second bounded queue in input order, and a sequencer thread writes
+ * each chunk's text once it is ready, so the output is the same as
+ * predicting one post at a time, and adds up the chunks' tallies.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.hpp"
+#include "Classifier.hpp"
+#include "OutputWriter.hpp"
+
+template <typename Batch>
+class ParallelPredictor {
+public:
+  // Number of posts scored and formatted together
+  static const size_t CHUNK_ROWS = 64;
+
+  // REQUIRES: num_threads >= 1, classifier is not modified or destroyed
+  //           until finish() returns
+  // MODIFIES: classifier
+  // EFFECTS : Starts num_threads scorers predicting with classifier, and a
+  //           sequencer writing their results to out.
+  ParallelPredictor(Classifier &classifier, int num_threads,
+                    OutputWriter &out)
+    : classifier(classifier), out(out), work(4 * num_threads),
+      order(8 * num_threads) {
+    classifier.prepare_prediction();
+    for (int t = 0; t < num_threads; ++t) {
+      scorers.emplace_back([this]() { score(); });
+    }
+    sequencer = std::thread([this]() { write(); });
+  }
+
+  // EFFECTS : Waits for every added post to be written.
+  ~ParallelPredictor() {
+    try {
+      finish();
+    } catch (...) {
+      // already reported by finish(), or abandoned with the predictor
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Queues every row of batch for prediction, waiting while too
+  //           many posts are in flight.
+  void add(std::shared_ptr<const Batch> batch) {
+    for (size_t first = 0; first < batch->size(); first += CHUNK_ROWS) {
+      Chunk chunk;
+      chunk.batch = batch;
+      chunk.first = first;
+      chunk.last = std::min(batch->size(), first + CHUNK_ROWS);
+      order.push(chunk.result.get_future());
+      work.push(std::move(chunk));
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Waits until every added post is written. Rethrows the first
+  //           exception thrown while predicting, if any.
+  void finish() {
+    if (finished) {
+      return;
+    }
+    finished = true;
+    work.close();
+    for (auto &scorer : scorers) {
+      scorer.join();
+    }
+    order.close();
+    sequencer.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // REQUIRES: finish() has returned
+  // EFFECTS : Returns the number of posts predicted correctly.
+  int number_correct() const {
+    return correct;
+  }
+
+  // REQUIRES: finish() has returned
+  // EFFECTS : Returns the number of posts predicted.
+  int number_predicted() const {
+    return total;
+  }
+
+  // REQUIRES: finish() has returned
+  // EFFECTS : Returns the hits and misses of the scorers' prediction
+  //           caches, added up.
+  PredictionCache::Stats cache_stats() const {
+    return cached;
+  }
+
+private:
+  // printed predictions of a chunk, and how many were correct
+  struct Result {
+    std::string text;
+    int correct = 0;
+    int total = 0;
+  };
+
+  // rows [first, last) of batch
+  struct Chunk {
+    std::shared_ptr<const Batch> batch;
+    size_t first = 0;
+    size_t last = 0;
+    std::promise<Result> result;
+  };
+
+  const Classifier &classifier;
+  OutputWriter &out;
+  BoundedQueue<Chunk> work;
+  BoundedQueue<std::future<Result>> order;
+  std::vector<std::thread> scorers;
+  std::thread sequencer;
+  bool finished = false;
+
+  // written only by the sequencer until finish() joins it
+  int correct = 0;
+  int total = 0;
+  std::exception_ptr error;
+
+  // added to by each scorer as it stops
+  std::mutex cached_mutex;
+  PredictionCache::Stats cached;
+
+  // EFFECTS : Predicts chunks from the work queue until it is closed.
+  void score() {
+    PredictionScratch scratch;
+    OutputWriter text(out.get_precision());
+    Chunk chunk;
+    while (work.pop(chunk)) {
+      try {
+        text.clear();
+        chunk.result.set_value(predict(chunk, scratch, text));
+      } catch (...) {
+        chunk.result.set_exception(std::current_exception());
+      }
+    }
+    PredictionCache::Stats stats = scratch.cache.stats();
+    std::lock_guard<std::mutex> lock(cached_mutex);
+    cached.hits += stats.hits;
+    cached.misses += stats.misses;
+  }
+
+  // MODIFIES: scratch, text
+  // EFFECTS : Returns the printed predictions of the rows of chunk.
+  Result predict(const Chunk &chunk, PredictionScratch &scratch,
+                 OutputWriter &text) const {
+    const Batch &batch = *chunk.batch;
+    size_t tag_column = batch.column_index("tag");
+    size_t content_column = batch.column_index("content");
+    Result result;
+    for (size_t i = chunk.first; i < chunk.last; ++i) {
+      std::string_view tag = batch.value(tag_column, i);
+      std::string_view content = batch.value(content_column, i);
+      auto prediction = classifier.predict(content, scratch);
+      Classifier::print_prediction(text, tag, content, prediction);
+      result.correct += tag == prediction.first;
+      result.total++;
+    }
+    result.text = text.contents();
+    return result;
+  }
+
+  // EFFECTS : Writes the result of each chunk in input order, and adds up
+  //           the tallies.
+  void write() {
+    std::future<Result> next;
+    while (order.pop(next)) {
+      try {
+        Result result = next.get();
+        if (!error) {
+          out << result.text;
+          correct += result.correct;
+          total += result.total;
+        }
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+  }
+};
+
+#endif // PARALLELPREDICTOR_HPP
@@ -0,0 +1,217 @@
+#ifndef PREDICTIONCACHE_HPP
+#define PREDICTIONCACHE_HPP
+/* PredictionCache.hpp
+ *
+ * Bounded least-recently-used cache of predictions, for traffic where the
+ * same post comes back again and again. Naive Bayes only looks at which
+ * words a post contains, so posts with the same set of unique words have
+ * the same prediction, however the words are ordered, repeated or spaced.
+ *
+ * A lookup hashes each word of the post and orders the unique words by
+ * their hashes, which is much cheaper than sorting them as strings, and
+ * keys the cache by that ordered set. Entries are found by a hash of the
+ * whole set, but a hit also compares the words, so two word sets whose
+ * hashes collide never share an entry. Each lookup names the version of
+ * the model it predicts with, and a new version empties the cache, so it
+ * never returns a stale prediction.
+ *
+ * BasicPredictionCache takes the hash of words as a template parameter;
+ * PredictionCache is the instance used for prediction.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Tokenizer.hpp"
+
+template <typename WordHash>
+class BasicPredictionCache {
+public:
+  // A predicted label and its log-probability score
+  using Prediction = std::pair<std::string, double>;
+
+  // Lookups that found an entry, and that did not
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  // EFFECTS : Creates a cache holding at most capacity predictions; 0
+  //           caches nothing.
+  explicit BasicPredictionCache(size_t capacity = 0)
+    : limit(capacity) {}
+
+  BasicPredictionCache(const BasicPredictionCache &other)
+    : limit(other.limit), counts(other.counts) {}
+
+  BasicPredictionCache & operator=(const BasicPredictionCache &other) {
+    limit = other.limit;
+    counts = other.counts;
+    clear();
+    return *this;
+  }
+
+  // EFFECTS : Returns the most predictions held at once.
+  size_t capacity() const {
+    return limit;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Holds at most capacity predictions from now on, and empties
+  //           the cache.
+  void set_capacity(size_t capacity) {
+    limit = capacity;
+    clear();
+  }
+
+  // EFFECTS : Returns the number of predictions held.
+  size_t size() const {
+    return index.size();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Returns the prediction cached for a post with the unique
+  //           whitespace delimited words of content, predicted with model
+  //           version, and marks it most recently used, or returns
+  //           nullptr. The pointer is valid until the next call. Entries
+  //           of other versions are dropped.
+  const Prediction * find(uint64_t version, std::string_view content) {
+    if (version != current_version) {
+      clear();
+      current_version = version;
+    }
+    set_key(content);
+    auto found = index.find(Key{key_hash, key});
+    if (found == index.end()) {
+      counts.misses++;
+      return nullptr;
+    }
+    counts.hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return &found->second->prediction;
+  }
+
+  // REQUIRES: the last find() returned nullptr
+  // MODIFIES: this
+  // EFFECTS : Caches prediction for the words of the last find(), evicting
+  //           the least recently used prediction if the cache is full,
+  //           and returns prediction.
+  const Prediction & insert(Prediction prediction) {
+    if (limit == 0) {
+      last = std::move(prediction);
+      return last;
+    }
+    if (index.size() < limit) {
+      entries.emplace_front();
+    } else {
+      // reuse the oldest entry, and the memory of its strings
+      index.erase(Key{entries.back().hash, entries.back().key});
+      entries.splice(entries.begin(), entries, std::prev(entries.end()));
+    }
+    Entry &entry = entries.front();
+    entry.key = key;
+    entry.hash = key_hash;
+    entry.prediction = std::move(prediction);
+    index.emplace(Key{entry.hash, entry.key}, entries.begin());
+    return entry.prediction;
+  }
+
+  // EFFECTS : Returns the hits and misses of every find() so far.
+  Stats stats() const {
+    return counts;
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    uint64_t hash;
+    Prediction prediction;
+  };
+
+  // a word set and its hash, viewing the words of a key
+  struct Key {
+    uint64_t hash;
+    std::string_view words;
+
+    bool operator==(const Key &other) const {
+      return hash == other.hash && words == other.words;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return key.hash;
+    }
+  };
+
+  size_t limit;
+  Stats counts;
+  uint64_t current_version = 0;
+
+  // most recently used first; nodes never move, so the index keys can
+  // view their strings
+  std::list<Entry> entries;
+  std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash>
+    index;
+
+  // the words of the last find() and their hashes, its key, and the
+  // prediction inserted when nothing is cached
+  WordHash word_hash;
+  std::vector<std::pair<uint64_t, std::string_view>> words;
+  std::string key;
+  uint64_t key_hash = 0;
+  Prediction last;
+
+  // MODIFIES: this
+  // EFFECTS : Sets key to the unique words of content ordered by hash, then
+  //           by text, joined by spaces, and key_hash to the hash of the
+  //           set.
+  void set_key(std::string_view content) {
+    words.clear();
+    size_t i = 0;
+    size_t size = content.size();
+    while (i < size) {
+      while (i < size && Tokenizer::is_space(content[i])) {
+        ++i;
+      }
+      size_t start = i;
+      while (i < size && !Tokenizer::is_space(content[i])) {
+        ++i;
+      }
+      if (i > start) {
+        std::string_view word = content.substr(start, i - start);
+        words.emplace_back(word_hash(word), word);
+      }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    key.clear();
+    key_hash = words.size();
+    for (auto &word : words) {
+      if (!key.empty()) {
+        key += ' ';
+      }
+      key += word.second;
+      key_hash = (key_hash ^ word.first) * 0x100000001b3;
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Drops every entry.
+  void clear() {
+    index.clear();
+    entries.clear();
+  }
+};
+
+using PredictionCache = BasicPredictionCache<std::hash<std::string_view>>;
+
+#endif // PREDICTIONCACHE_HPP
@@ -0,0 +1,110 @@
+#include "PredictionCache.hpp"
+#include "unit_test_framework.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Hash that gives every word, and so every word set of a size, the same
+// hash
+struct CollidingHash {
+  size_t operator()(string_view) const {
+    return 42;
+  }
+};
+
+using Prediction = PredictionCache::Prediction;
+
+TEST(cache_hits_same_word_set) {
+  PredictionCache cache(4);
+  ASSERT_TRUE(cache.find(1, "left card") == nullptr);
+  cache.insert(Prediction("euchre", -3.5));
+
+  const Prediction *hit = cache.find(1, "left card");
+  ASSERT_TRUE(hit != nullptr);
+  ASSERT_EQUAL(hit->first, "euchre");
+  ASSERT_EQUAL(hit->second, -3.5);
+
+  // the same words in another order, repeated or spaced differently
+  ASSERT_TRUE(cache.find(1, "card left") != nullptr);
+  ASSERT_TRUE(cache.find(1, " card\tleft card\n") != nullptr);
+  ASSERT_TRUE(cache.find(1, "cardleft") == nullptr);
+  ASSERT_TRUE(cache.find(1, "card") == nullptr);
+  ASSERT_TRUE(cache.find(1, "card left bower") == nullptr);
+  ASSERT_EQUAL(cache.stats().hits, 3u);
+  ASSERT_EQUAL(cache.stats().misses, 4u);
+}
+
+TEST(cache_evicts_least_recently_used) {
+  PredictionCache cache(2);
+  cache.find(1, "a");
+  cache.insert(Prediction("x", -1));
+  cache.find(1, "b");
+  cache.insert(Prediction("y", -2));
+  ASSERT_TRUE(cache.find(1, "a") != nullptr);
+
+  // "b" is the least recently used
+  ASSERT_TRUE(cache.find(1, "c") == nullptr);
+  cache.insert(Prediction("z", -3));
+  ASSERT_EQUAL(cache.size(), 2u);
+  ASSERT_TRUE(cache.find(1, "b") == nullptr);
+  cache.insert(Prediction("y", -2));
+  ASSERT_TRUE(cache.find(1, "a") == nullptr);
+  cache.insert(Prediction("x", -1));
+  ASSERT_EQUAL(cache.find(1, "b")->first, "y");
+}
+
+TEST(cache_keeps_colliding_keys_apart) {
+  BasicPredictionCache<CollidingHash> cache(8);
+  for (int i = 0; i < 8; ++i) {
+    string word = "word" + to_string(i);
+    ASSERT_TRUE(cache.find(1, word) == nullptr);
+    cache.insert(Prediction("label" + to_string(i), -i));
+  }
+  for (int i = 7; i >= 0; --i) {
+    string word = "word" + to_string(i);
+    const auto *hit = cache.find(1, word);
+    ASSERT_TRUE(hit != nullptr);
+    ASSERT_EQUAL(hit->first, "label" + to_string(i));
+  }
+  ASSERT_TRUE(cache.find(1, "word8") == nullptr);
+
+  // words with equal hashes are ordered by text, so the set is still
+  // found in any order
+  cache.find(1, "left card");
+  cache.insert(Prediction("euchre", -1));
+  ASSERT_EQUAL(cache.find(1, "card left")->first, "euchre");
+  ASSERT_TRUE(cache.find(1, "card bower") == nullptr);
+}
+
+TEST(cache_drops_entries_of_other_versions) {
+  PredictionCache cache(4);
+  cache.find(1, "stack");
+  cache.insert(Prediction("calculator", -1));
+  ASSERT_TRUE(cache.find(2, "stack") == nullptr);
+  ASSERT_EQUAL(cache.size(), 0u);
+  cache.insert(Prediction("euchre", -2));
+  ASSERT_EQUAL(cache.find(2, "stack")->first, "euchre");
+}
+
+TEST(cache_without_capacity_holds_nothing) {
+  PredictionCache cache;
+  ASSERT_TRUE(cache.find(1, "stack") == nullptr);
+  ASSERT_EQUAL(cache.insert(Prediction("calculator", -1)).first,
+               "calculator");
+  ASSERT_TRUE(cache.find(1, "stack") == nullptr);
+  ASSERT_EQUAL(cache.size(), 0u);
+}
+
+TEST(cache_copies_start_empty) {
+  PredictionCache cache(4);
+  cache.find(1, "stack");
+  cache.insert(Prediction("calculator", -1));
+  PredictionCache copy = cache;
+  ASSERT_EQUAL(copy.capacity(), 4u);
+  ASSERT_TRUE(copy.find(1, "stack") == nullptr);
+  ASSERT_TRUE(cache.find(1, "stack") != nullptr);
+}
+
+TEST_MAIN()
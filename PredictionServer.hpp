@@ -0,0 +1,315 @@
+#ifndef PREDICTIONSERVER_HPP
+#define PREDICTIONSERVER_HPP
+/* PredictionServer.hpp
+ *
+ * Answers prediction requests from a trained Classifier, over a pair of
+ * file descriptors such as stdin and stdout, or over a Unix domain socket.
+ *
+ * The protocol is line-delimited: each request is one line of content, and
+ * each response is one line holding the predicted label, a space and the
+ * log-probability score. Responses come back in request order, so a client
+ * may pipeline requests without waiting for the answers. Every line that
+ * one read brings in is predicted as a batch and answered with one write.
+ * Content with line breaks is sent with them replaced by spaces, which
+ * does not change its words.
+ *
+ * The line "#reload" is a command rather than content: it starts a reload
+ * of the model, see ModelHandle, and is answered "reloading", or "busy" if
+ * a reload is already in progress. Each batch is predicted from one
+ * snapshot of the model, so a reload never stalls or splits a batch.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Classifier.hpp"
+#include "ModelHandle.hpp"
+#include "OutputWriter.hpp"
+
+class PredictionServerError : public std::runtime_error {
+public:
+  explicit PredictionServerError(const std::string &msg)
+    : std::runtime_error(msg) {}
+};
+
+class PredictionServer {
+public:
+  // Bytes read from a connection at a time
+  static const size_t READ_SIZE = 1 << 16;
+
+  // Request line that reloads the model
+  static constexpr std::string_view RELOAD = "#reload";
+
+  // Default connections served at once on a socket; more wait to be
+  // accepted
+  static const size_t MAX_CONNECTIONS = 64;
+
+  // Wait before accepting again when out of descriptors or memory
+  static constexpr std::chrono::milliseconds ACCEPT_BACKOFF{100};
+
+  // REQUIRES: models is not destroyed while serving, max_connections > 0
+  // EFFECTS : Creates a server predicting with the current version of
+  //           models, serving at most max_connections at once on a socket.
+  //           Throws PredictionServerError if it cannot be stopped.
+  explicit PredictionServer(ModelHandle &models,
+                            size_t max_connections = MAX_CONNECTIONS)
+    : models(models), max_connections(max_connections) {
+    if (pipe(stop_pipe) < 0) {
+      throw PredictionServerError("Error creating stop pipe");
+    }
+    fcntl(stop_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(stop_pipe[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  // EFFECTS : Hangs up on every socket connection and waits for their
+  //           threads to finish.
+  ~PredictionServer() {
+    close_connections();
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+  }
+
+  PredictionServer(const PredictionServer &) = delete;
+  PredictionServer &operator=(const PredictionServer &) = delete;
+
+  // EFFECTS : Answers the requests read from in_fd on out_fd until in_fd
+  //           ends or out_fd is closed. A last request without a line
+  //           break is answered too. Throws PredictionServerError if
+  //           in_fd cannot be read.
+  void serve_stream(int in_fd, int out_fd) const {
+    // a client that hangs up only ends its own stream
+    std::signal(SIGPIPE, SIG_IGN);
+    PredictionScratch scratch;
+    std::string pending;
+    OutputWriter responses;
+    char buffer[READ_SIZE];
+    for (;;) {
+      ssize_t count = read(in_fd, buffer, sizeof(buffer));
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count < 0) {
+        throw PredictionServerError("Error reading requests");
+      }
+      if (count == 0) {
+        break;
+      }
+      pending.append(buffer, count);
+      size_t used = answer_lines(pending, scratch, responses);
+      pending.erase(0, used);
+      if (!write_all(out_fd, responses.contents())) {
+        return;
+      }
+      responses.clear();
+    }
+    if (!pending.empty()) {
+      answer(*models.snapshot(), pending, scratch, responses);
+      write_all(out_fd, responses.contents());
+    }
+  }
+
+  // EFFECTS : Listens on a Unix domain socket at path, replacing any file
+  //           there, and answers each connection on its own thread until
+  //           stop() is called. It then hangs up on every connection,
+  //           waits for their threads, removes the socket file and
+  //           returns. At most max_connections are served at once, and
+  //           accepting backs off while out of descriptors or memory.
+  //           Throws PredictionServerError if the socket cannot be set up
+  //           or accepting fails otherwise, after hanging up on every
+  //           connection.
+  void serve_socket(const std::string &path) const {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+      throw PredictionServerError("Socket path too long: " + path);
+    }
+    path.copy(address.sun_path, path.size());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+      throw PredictionServerError("Error creating socket: " + path);
+    }
+    unlink(path.c_str());
+    // non-blocking, so that a client hanging up between poll and accept
+    // never blocks the loop that watches for stop()
+    if (fcntl(listener, F_SETFL, O_NONBLOCK) < 0 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+      close(listener);
+      throw PredictionServerError("Error listening on socket: " + path);
+    }
+
+    // a client that hangs up only ends its own connection
+    std::signal(SIGPIPE, SIG_IGN);
+    while (wait_for_room()) {
+      pollfd events[2] = {{listener, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+      if (poll(events, 2, -1) < 0 && errno != EINTR) {
+        close(listener);
+        close_connections();
+        throw PredictionServerError("Error polling socket: " + path);
+      }
+      if (events[1].revents != 0) {
+        break;
+      }
+      if (events[0].revents == 0) {
+        continue;
+      }
+      int connection = accept(listener, nullptr, nullptr);
+      if (connection < 0) {
+        if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN ||
+            errno == EWOULDBLOCK) {
+          continue;
+        }
+        if (errno == EMFILE || errno == ENFILE || errno == ENOMEM ||
+            errno == ENOBUFS) {
+          // closing connections frees what accept needs
+          std::this_thread::sleep_for(ACCEPT_BACKOFF);
+          continue;
+        }
+        close(listener);
+        close_connections();
+        throw PredictionServerError("Error accepting on socket: " + path);
+      }
+      start_connection(connection);
+    }
+    close(listener);
+    close_connections();
+    unlink(path.c_str());
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Makes serve_socket return, now or as soon as it is called.
+  //           May be called from any thread.
+  void stop() {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    if (!stopping) {
+      stopping = true;
+      connections_changed.notify_all();
+      // a byte in the pipe wakes serve_socket from poll, and stays there
+      // for later calls
+      char byte = 0;
+      while (write(stop_pipe[1], &byte, 1) < 0 && errno == EINTR) {
+      }
+    }
+  }
+
+private:
+  ModelHandle &models;
+  size_t max_connections;
+
+  // written to by stop(), and polled by serve_socket
+  int stop_pipe[2];
+
+  // Socket connections being served, and whether stop() was called,
+  // guarded by connections_mutex
+  mutable std::set<int> connections;
+  bool stopping = false;
+  mutable std::mutex connections_mutex;
+  mutable std::condition_variable connections_changed;
+
+  // EFFECTS : Waits until fewer than max_connections are being served, or
+  //           stop() is called, and returns whether it was not.
+  bool wait_for_room() const {
+    std::unique_lock<std::mutex> lock(connections_mutex);
+    connections_changed.wait(lock, [this]() {
+      return connections.size() < max_connections || stopping;
+    });
+    return !stopping;
+  }
+
+  // MODIFIES: connections
+  // EFFECTS : Answers connection on its own thread, which closes it when
+  //           the client hangs up.
+  void start_connection(int connection) const {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connections.insert(connection);
+    // the thread is tracked in connections rather than joined, and the
+    // destructor waits for it
+    std::thread([this, connection]() {
+      try {
+        serve_stream(connection, connection);
+      } catch (const PredictionServerError &) {
+        // the connection broke; others carry on
+      }
+      // closed under the lock, so close_connections never shuts down a
+      // descriptor that was reused
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      close(connection);
+      connections.erase(connection);
+      connections_changed.notify_all();
+    }).detach();
+  }
+
+  // MODIFIES: connections
+  // EFFECTS : Hangs up on every connection and waits for their threads to
+  //           close them.
+  void close_connections() const {
+    std::unique_lock<std::mutex> lock(connections_mutex);
+    for (int connection : connections) {
+      shutdown(connection, SHUT_RDWR);
+    }
+    connections_changed.wait(lock, [this]() {
+      return connections.empty();
+    });
+  }
+
+  // MODIFIES: scratch, responses
+  // EFFECTS : Appends the response to each complete line of requests to
+  //           responses, and returns the number of bytes used.
+  size_t answer_lines(std::string_view requests, PredictionScratch &scratch,
+                      OutputWriter &responses) const {
+    std::shared_ptr<const ModelHandle::Version> model = models.snapshot();
+    size_t start = 0;
+    size_t end;
+    while ((end = requests.find('\n', start)) != std::string_view::npos) {
+      answer(*model, requests.substr(start, end - start), scratch,
+             responses);
+      start = end + 1;
+    }
+    return start;
+  }
+
+  // MODIFIES: scratch, responses, models
+  // EFFECTS : Appends the response to the request content to responses,
+  //           predicted with model, or runs the request if it is a command.
+  void answer(const ModelHandle::Version &model, std::string_view content,
+              PredictionScratch &scratch, OutputWriter &responses) const {
+    if (content == RELOAD) {
+      responses << (models.reload() ? "reloading\n" : "busy\n");
+      return;
+    }
+    std::pair<std::string, double> prediction =
+      model.classifier->predict(content, scratch);
+    responses << prediction.first << ' ' << prediction.second << '\n';
+  }
+
+  // EFFECTS : Writes all of bytes to fd, and returns false if fd is closed.
+  static bool write_all(int fd, std::string_view bytes) {
+    while (!bytes.empty()) {
+      ssize_t count = write(fd, bytes.data(), bytes.size());
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        return false;
+      }
+      bytes.remove_prefix(count);
+    }
+    return true;
+  }
+};
+
+#endif // PREDICTIONSERVER_HPP
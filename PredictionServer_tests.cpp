@@ -0,0 +1,268 @@
+#include "PredictionServer.hpp"
+#include "test_posts.hpp"
+#include "unit_test_framework.hpp"
+#include <chrono>
+#include <cstdio>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// EFFECTS return the response line expected for content
+static string expected(Classifier &classifier, const string &content) {
+  auto prediction = classifier.compute_most_probable_tag(content);
+  char score[32];
+  snprintf(score, sizeof(score), "%.3g", prediction.second);
+  return prediction.first + " " + score + "\n";
+}
+
+// EFFECTS send each of writes to a server on a socket pair, one write at
+//         a time, then hang up, and return everything it answered
+static string exchange(const vector<string> &writes) {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ModelHandle models([]() { return trained(); });
+  PredictionServer server(models);
+  thread serving([&server, &fds]() {
+    server.serve_stream(fds[1], fds[1]);
+    shutdown(fds[1], SHUT_WR);
+  });
+  for (const string &bytes : writes) {
+    ASSERT_EQUAL(write(fds[0], bytes.data(), bytes.size()),
+                 ssize_t(bytes.size()));
+  }
+  shutdown(fds[0], SHUT_WR);
+
+  string responses;
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    responses.append(buffer, count);
+  }
+  serving.join();
+  close(fds[0]);
+  close(fds[1]);
+  return responses;
+}
+
+TEST(server_answers_pipelined_requests_in_order) {
+  Classifier classifier = move(*trained());
+  string requests;
+  string responses;
+  for (auto &post : POSTS) {
+    requests += post.second + "\n";
+    responses += expected(classifier, post.second);
+  }
+  ASSERT_EQUAL(exchange({requests}), responses);
+}
+
+TEST(server_joins_requests_split_across_reads) {
+  Classifier classifier = move(*trained());
+  string answer = exchange({"how to ro", "tate the", " image\nca",
+                            "rd upcard\r\n"});
+  ASSERT_EQUAL(answer, expected(classifier, "how to rotate the image") +
+                       expected(classifier, "card upcard"));
+}
+
+TEST(server_answers_last_line_and_empty_lines) {
+  Classifier classifier = move(*trained());
+  string answer = exchange({"\nleft bower"});
+  ASSERT_EQUAL(answer, expected(classifier, "") +
+                       expected(classifier, "left bower"));
+}
+
+TEST(server_reloads_on_request) {
+  Classifier classifier = move(*trained());
+  string answer = exchange({"#reload\nleft bower\n"});
+  string reloading = "reloading\n";
+  ASSERT_EQUAL(answer, reloading + expected(classifier, "left bower"));
+}
+
+TEST(server_stops_when_output_is_closed) {
+  int requests[2];
+  int responses[2];
+  ASSERT_EQUAL(pipe(requests), 0);
+  ASSERT_EQUAL(pipe(responses), 0);
+  close(responses[0]);
+  string request = "left bower\n";
+  ASSERT_EQUAL(write(requests[1], request.data(), request.size()),
+               ssize_t(request.size()));
+  close(requests[1]);
+
+  // writing to a pipe nobody reads raises SIGPIPE, which must not end
+  // the process
+  ModelHandle models([]() { return trained(); });
+  PredictionServer server(models);
+  server.serve_stream(requests[0], responses[1]);
+  close(requests[0]);
+  close(responses[1]);
+}
+
+// EFFECTS connect to the Unix domain socket at path, waiting up to a few
+//         seconds for it to listen, and return the connection or -1
+static int connect_to(const string &path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  path.copy(address.sun_path, path.size());
+  for (int i = 0; i < 5000; ++i) {
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(connection, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) == 0) {
+      return connection;
+    }
+    close(connection);
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  return -1;
+}
+
+// EFFECTS send requests over connection, hang up, and return everything
+//         the server answered
+static string round_trip(int connection, const string &requests) {
+  ASSERT_EQUAL(write(connection, requests.data(), requests.size()),
+               ssize_t(requests.size()));
+  shutdown(connection, SHUT_WR);
+  string responses;
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(connection, buffer, sizeof(buffer))) > 0) {
+    responses.append(buffer, count);
+  }
+  close(connection);
+  return responses;
+}
+
+// EFFECTS send request over connection and return the one line answered
+static string ask(int connection, const string &request) {
+  ASSERT_EQUAL(write(connection, request.data(), request.size()),
+               ssize_t(request.size()));
+  string line;
+  char c;
+  while (read(connection, &c, 1) == 1) {
+    line += c;
+    if (c == '\n') {
+      break;
+    }
+  }
+  return line;
+}
+
+// EFFECTS return whether connection has something to read within ms
+static bool readable(int connection, int ms) {
+  pollfd event = {connection, POLLIN, 0};
+  return poll(&event, 1, ms) > 0;
+}
+
+// A server answering on a socket on its own thread, stopped and destroyed
+// with this object
+struct SocketServer {
+  ModelHandle models{[]() { return trained(); }};
+  PredictionServer server;
+  string path = "PredictionServer_tests." + to_string(getpid()) + ".sock";
+  thread serving;
+
+  explicit SocketServer(
+      size_t max_connections = PredictionServer::MAX_CONNECTIONS)
+    : server(models, max_connections),
+      serving([this]() { server.serve_socket(path); }) {}
+
+  ~SocketServer() {
+    server.stop();
+    serving.join();
+  }
+};
+
+TEST(server_answers_over_a_socket) {
+  Classifier classifier = move(*trained());
+  SocketServer socket_server;
+
+  // two clients at once, each answered in order on its own connection
+  int first = connect_to(socket_server.path);
+  int second = connect_to(socket_server.path);
+  ASSERT_TRUE(first >= 0 && second >= 0);
+  ASSERT_EQUAL(round_trip(second, "left bower\n"),
+               expected(classifier, "left bower"));
+  ASSERT_EQUAL(round_trip(first, "how to rotate the image\ncard"),
+               expected(classifier, "how to rotate the image") +
+               expected(classifier, "card"));
+}
+
+TEST(server_stop_hangs_up_and_returns) {
+  ModelHandle models([]() { return trained(); });
+  PredictionServer server(models);
+  string path = "PredictionServer_tests." + to_string(getpid()) + ".sock";
+  thread serving([&server, &path]() { server.serve_socket(path); });
+  int client = connect_to(path);
+  ASSERT_TRUE(client >= 0);
+  ASSERT_EQUAL(ask(client, "left bower\n"),
+               expected(*trained(), "left bower"));
+
+  // the idle client is hung up on, and the socket file removed
+  server.stop();
+  serving.join();
+  char c;
+  ASSERT_EQUAL(read(client, &c, 1), ssize_t(0));
+  ASSERT_TRUE(access(path.c_str(), F_OK) != 0);
+  close(client);
+}
+
+TEST(server_serves_waiting_client_when_another_hangs_up) {
+  Classifier classifier = move(*trained());
+  string answer = expected(classifier, "left bower");
+  SocketServer socket_server(2);
+  int first = connect_to(socket_server.path);
+  int second = connect_to(socket_server.path);
+  ASSERT_EQUAL(ask(first, "left bower\n"), answer);
+  ASSERT_EQUAL(ask(second, "left bower\n"), answer);
+
+  // a third client connects, but is not accepted while two are served
+  int third = connect_to(socket_server.path);
+  ASSERT_TRUE(third >= 0);
+  string request = "left bower\n";
+  ASSERT_EQUAL(write(third, request.data(), request.size()),
+               ssize_t(request.size()));
+  ASSERT_FALSE(readable(third, 200));
+
+  close(first);
+  ASSERT_EQUAL(ask(third, ""), answer);
+  close(second);
+  close(third);
+}
+
+TEST(server_backs_off_while_out_of_descriptors) {
+  Classifier classifier = move(*trained());
+  SocketServer socket_server;
+  int first = connect_to(socket_server.path);
+  ASSERT_EQUAL(ask(first, "left bower\n"), expected(classifier, "left bower"));
+
+  // with no descriptor left for accept, the client waits instead of the
+  // server failing
+  int client = socket(AF_UNIX, SOCK_STREAM, 0);
+  rlimit limits;
+  getrlimit(RLIMIT_NOFILE, &limits);
+  rlimit lowered = limits;
+  lowered.rlim_cur = dup(0);
+  close(lowered.rlim_cur);
+  ASSERT_EQUAL(setrlimit(RLIMIT_NOFILE, &lowered), 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  socket_server.path.copy(address.sun_path, socket_server.path.size());
+  ASSERT_EQUAL(connect(client, reinterpret_cast<sockaddr *>(&address),
+                       sizeof(address)), 0);
+  string request = "card\n";
+  ASSERT_EQUAL(write(client, request.data(), request.size()),
+               ssize_t(request.size()));
+  bool answered_early = readable(client, 300);
+  setrlimit(RLIMIT_NOFILE, &limits);
+
+  ASSERT_FALSE(answered_early);
+  ASSERT_EQUAL(ask(client, ""), expected(classifier, "card"));
+  close(first);
+  close(client);
+}
+
+TEST_MAIN()
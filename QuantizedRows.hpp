@@ -0,0 +1,245 @@
+#ifndef QUANTIZEDROWS_HPP
+#define QUANTIZEDROWS_HPP
+/* QuantizedRows.hpp
+ *
+ * Dense per-word rows of a ModelFile's log-likelihoods, like ScoreRows,
+ * stored in 1 or 2 bytes per (word, label) instead of 8, so that more
+ * models fit in memory. Each label has its own offset and scale, and
+ * stores every log-likelihood of the label as
+ *
+ *   INT8   offset + scale * q, q an int8 in [-127, 127]
+ *   FP16   offset + scale * h, h a half-precision float in [0, 1]
+ *
+ * Scoring dequantizes inside the kernel: a post's stored values are added
+ * up per label, and each label's offset and scale are applied once to the
+ * sum, which is exact for INT8. Rows are added with the instruction sets
+ * of ScoreRows. Scores differ from exact scoring by at most term_error()
+ * per word of the post.
+ *
+ * The rows can be saved in a quantized ModelFile. Rows built from a model
+ * quantized in the same format point into its mapping rather than copying
+ * it, and no log-likelihood is computed as a double.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "ModelFile.hpp"
+#include "ScoreRows.hpp"
+
+class QuantizedRows {
+public:
+  // How each log-likelihood is stored
+  enum Format { INT8, FP16 };
+
+  // EFFECTS : Returns how a model file stores values in format.
+  static ModelQuantization quantization(Format format) {
+    return format == INT8 ? QUANTIZED_INT8 : QUANTIZED_FP16;
+  }
+
+  // REQUIRES: model outlives these rows, or the next build
+  // MODIFIES: this
+  // EFFECTS : Builds the rows of model in format, reading them in place if
+  //           model is quantized in format.
+  void build(const ModelFile &model, Format format) {
+    this->format = format;
+    labels = model.num_labels();
+    size_t rows = model.num_words() + 1;
+    num_values = rows * labels;
+    priors.resize(labels);
+    offsets.resize(labels);
+    scales.resize(labels);
+    for (size_t label = 0; label < labels; ++label) {
+      priors[label] = model.log_prior(label);
+    }
+    bytes.clear();
+    halves.clear();
+    mapped_bytes = nullptr;
+    mapped_halves = nullptr;
+    if (model.quantization() == quantization(format)) {
+      for (size_t label = 0; label < labels; ++label) {
+        offsets[label] = model.quantized_offset(label);
+        scales[label] = model.quantized_scale(label);
+      }
+      if (format == INT8) {
+        mapped_bytes = model.quantized_bytes();
+      } else {
+        mapped_halves = model.quantized_halves();
+      }
+      return;
+    }
+
+    std::vector<double> values(num_values);
+    for (size_t label = 0; label < labels; ++label) {
+      values[label] = model.unknown_log_likelihood();
+    }
+    for (int word = 0; word < model.num_words(); ++word) {
+      double *row = &values[(word + 1) * labels];
+      std::fill(row, row + labels, model.fallback_log_likelihood(word));
+      for (uint64_t entry = model.entries_begin(word);
+           entry < model.entries_end(word); ++entry) {
+        row[model.entry_label(entry)] = model.entry_log_likelihood(entry);
+      }
+    }
+
+    for (size_t label = 0; label < labels; ++label) {
+      set_range(values, label);
+    }
+    if (format == INT8) {
+      bytes.resize(values.size());
+    } else {
+      halves.resize(values.size());
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+      size_t label = i % labels;
+      double scaled = (values[i] - offsets[label]) / scales[label];
+      if (format == INT8) {
+        bytes[i] = int8_t(std::lround(std::clamp(scaled, -127.0, 127.0)));
+      } else {
+        halves[i] = to_half(float(std::clamp(scaled, 0.0, 1.0)));
+      }
+    }
+  }
+
+  // EFFECTS : Returns whether there are rows to score with.
+  bool empty() const {
+    return num_values == 0;
+  }
+
+  // EFFECTS : Returns the bytes taken by the rows, whether they were
+  //           built or are read from a model file.
+  size_t size_bytes() const {
+    size_t value_size = format == INT8 ? sizeof(int8_t) : sizeof(uint16_t);
+    return empty() ? 0 : num_values * value_size + 3 * labels * sizeof(double);
+  }
+
+  // REQUIRES: !empty()
+  // EFFECTS : Returns the rows, to be saved in a model file.
+  QuantizedData data() const {
+    QuantizedData data;
+    data.format = quantization(format);
+    data.offsets = offsets;
+    data.scales = scales;
+    if (format == INT8) {
+      data.bytes.assign(byte_rows(), byte_rows() + num_values);
+    } else {
+      data.halves.assign(half_rows(), half_rows() + num_values);
+    }
+    return data;
+  }
+
+  // EFFECTS : Returns the largest difference between a stored
+  //           log-likelihood and the exact one.
+  double term_error() const {
+    double largest = 0;
+    for (double scale : scales) {
+      // rounding to the nearest int8, or to 11 significant bits of a
+      // half in [0, 1]
+      largest = std::max(largest, format == INT8
+                         ? scale / 2 : scale * std::ldexp(1.0, -12));
+    }
+    return largest;
+  }
+
+  // REQUIRES: !empty(), scores has one entry per label, words are word
+  //           indexes of the model or -1 for words never seen
+  // MODIFIES: scores
+  // EFFECTS : Sets scores to the log-prior of each label plus the
+  //           dequantized log-likelihoods of words.
+  void score(const std::vector<int> &words, std::vector<double> &scores) const {
+    std::fill(scores.begin(), scores.end(), 0.0);
+    for (int word : words) {
+      size_t start = (word + 1) * labels;
+      if (format == INT8) {
+        ScoreRows::add_int8(scores.data(), byte_rows() + start, labels);
+      } else {
+        ScoreRows::add_half(scores.data(), half_rows() + start, labels);
+      }
+    }
+    double count = words.size();
+    for (size_t label = 0; label < labels; ++label) {
+      scores[label] = priors[label] + count * offsets[label] +
+        scales[label] * scores[label];
+    }
+  }
+
+  // EFFECTS : Returns value rounded to the nearest half-precision float,
+  //           ties to even, as its bits.
+  static uint16_t to_half(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31) {
+      return sign | 0x7c00;
+    }
+    int shift = 13;
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (exponent <= 0) {
+      // subnormal: the implicit bit becomes explicit, and the exponent
+      // moves into the shift
+      if (exponent < -10) {
+        return sign;
+      }
+      mantissa |= 0x800000;
+      shift = 14 - exponent;
+      half = mantissa >> shift;
+    }
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    // a carry out of the mantissa correctly moves up the exponent
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return sign | uint16_t(half);
+  }
+
+private:
+  Format format = INT8;
+  size_t labels = 0;
+  std::vector<double> priors;
+  std::vector<double> offsets;
+  std::vector<double> scales;
+
+  // the unknown-word row, then one row per word, in format: built into
+  // bytes or halves, or mapped from a quantized model file, which then
+  // outlives these rows
+  size_t num_values = 0;
+  std::vector<int8_t> bytes;
+  std::vector<uint16_t> halves;
+  const int8_t *mapped_bytes = nullptr;
+  const uint16_t *mapped_halves = nullptr;
+
+  const int8_t * byte_rows() const {
+    return mapped_bytes ? mapped_bytes : bytes.data();
+  }
+  const uint16_t * half_rows() const {
+    return mapped_halves ? mapped_halves : halves.data();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Sets the offset and scale of label so that its values fit
+  //           the stored range.
+  void set_range(const std::vector<double> &values, size_t label) {
+    double low = values[label];
+    double high = values[label];
+    for (size_t i = label; i < values.size(); i += labels) {
+      low = std::min(low, values[i]);
+      high = std::max(high, values[i]);
+    }
+    // a label whose values are all equal still needs a nonzero scale
+    double range = std::max(high - low, 1e-300);
+    if (format == INT8) {
+      offsets[label] = (low + high) / 2;
+      scales[label] = range / 254;
+    } else {
+      offsets[label] = low;
+      scales[label] = range;
+    }
+  }
+};
+
+#endif // QUANTIZEDROWS_HPP
@@ -0,0 +1,158 @@
+#include "QuantizedRows.hpp"
+#include "test_model.hpp"
+#include "unit_test_framework.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Word indexes of posts to score, with -1 for a word never seen
+static const vector<vector<int>> QUERIES = {
+  {}, {0}, {1}, {0, 1}, {-1}, {-1, 0, 1}
+};
+
+// EFFECTS return the exact score of words for label
+static double exact_score(const ModelFile &model, int label,
+                          const vector<int> &words) {
+  double score = model.log_prior(label);
+  for (int word : words) {
+    score += model.log_likelihood(label, word);
+  }
+  return score;
+}
+
+TEST(half_round_trips_every_finite_value) {
+  for (uint32_t bits = 0; bits < 0x10000; ++bits) {
+    uint16_t half = uint16_t(bits);
+    if ((half & 0x7c00) == 0x7c00) {
+      continue;
+    }
+    ASSERT_EQUAL(QuantizedRows::to_half(ScoreRows::from_half(half)),
+                 half);
+  }
+}
+
+TEST(half_rounds_to_nearest_even) {
+  ASSERT_EQUAL(ScoreRows::from_half(QuantizedRows::to_half(1.0f)), 1.0f);
+  // halfway between 1 and the next half rounds down to the even 1, and
+  // halfway above that rounds up to the even neighbour
+  float step = ldexp(1.0f, -10);
+  ASSERT_EQUAL(ScoreRows::from_half(QuantizedRows::to_half(1 + step / 2)),
+               1.0f);
+  ASSERT_EQUAL(ScoreRows::from_half(
+                 QuantizedRows::to_half(1 + 3 * step / 2)), 1 + 2 * step);
+  // subnormals, underflow and overflow
+  ASSERT_EQUAL(ScoreRows::from_half(
+                 QuantizedRows::to_half(ldexp(1.0f, -24))), ldexp(1.0f, -24));
+  ASSERT_EQUAL(QuantizedRows::to_half(ldexp(1.0f, -30)), 0);
+  ASSERT_EQUAL(QuantizedRows::to_half(1e6f), 0x7c00);
+}
+
+TEST(quantized_kernels_match_scalar_sums) {
+  // every int8 value and every finite half, in rows whose length leaves
+  // a tail for the plain loop
+  const size_t LABELS = 37;
+  vector<int8_t> bytes;
+  for (int value = -128; value < 128; ++value) {
+    bytes.push_back(int8_t(value));
+  }
+  vector<uint16_t> halves;
+  for (uint32_t bits = 0; bits < 0x10000; ++bits) {
+    if ((bits & 0x7c00) != 0x7c00) {
+      halves.push_back(uint16_t(bits));
+    }
+  }
+  bytes.resize((bytes.size() + LABELS - 1) / LABELS * LABELS);
+  halves.resize((halves.size() + LABELS - 1) / LABELS * LABELS);
+
+  vector<double> expected_bytes(LABELS);
+  vector<double> expected_halves(LABELS);
+  ScoreRows::limit_simd(ScoreRows::SCALAR);
+  for (size_t i = 0; i < bytes.size(); i += LABELS) {
+    ScoreRows::add_int8(expected_bytes.data(), &bytes[i], LABELS);
+  }
+  for (size_t i = 0; i < halves.size(); i += LABELS) {
+    ScoreRows::add_half(expected_halves.data(), &halves[i], LABELS);
+  }
+  for (ScoreRows::Simd simd : {ScoreRows::AVX2, ScoreRows::AVX512}) {
+    ScoreRows::limit_simd(simd);
+    vector<double> actual(LABELS);
+    for (size_t i = 0; i < bytes.size(); i += LABELS) {
+      ScoreRows::add_int8(actual.data(), &bytes[i], LABELS);
+    }
+    ASSERT_SEQUENCE_EQUAL(actual, expected_bytes);
+    actual.assign(LABELS, 0.0);
+    for (size_t i = 0; i < halves.size(); i += LABELS) {
+      ScoreRows::add_half(actual.data(), &halves[i], LABELS);
+    }
+    ASSERT_SEQUENCE_EQUAL(actual, expected_halves);
+  }
+  ScoreRows::limit_simd(ScoreRows::AVX512);
+}
+
+TEST(quantized_scores_stay_within_term_error) {
+  ModelFile model(small_model());
+  for (auto format : {QuantizedRows::INT8, QuantizedRows::FP16}) {
+    QuantizedRows rows;
+    ASSERT_TRUE(rows.empty());
+    rows.build(model, format);
+    ASSERT_FALSE(rows.empty());
+    ASSERT_TRUE(rows.term_error() > 0);
+    vector<double> scores(model.num_labels());
+    for (auto &words : QUERIES) {
+      rows.score(words, scores);
+      for (int label = 0; label < model.num_labels(); ++label) {
+        double bound = words.size() * rows.term_error() + 1e-12;
+        ASSERT_ALMOST_EQUAL(scores[label], exact_score(model, label, words),
+                            bound);
+      }
+    }
+  }
+}
+
+TEST(quantized_rows_take_one_or_two_bytes_per_value) {
+  ModelFile model(small_model());
+  QuantizedRows int8_rows;
+  int8_rows.build(model, QuantizedRows::INT8);
+  QuantizedRows fp16_rows;
+  fp16_rows.build(model, QuantizedRows::FP16);
+  // 3 rows of 2 labels, and a prior, offset and scale per label
+  ASSERT_EQUAL(int8_rows.size_bytes(), 6 + 6 * sizeof(double));
+  ASSERT_EQUAL(fp16_rows.size_bytes(), 12 + 6 * sizeof(double));
+}
+
+TEST(quantized_model_file_scores_from_its_rows) {
+  const string filename = "/tmp/QuantizedRows_tests.model";
+  ModelFile model(small_model());
+  for (auto format : {QuantizedRows::INT8, QuantizedRows::FP16}) {
+    QuantizedRows built;
+    built.build(model, format);
+    ModelFile::write(filename, small_model(), built.data());
+    ModelFile saved(filename);
+    ASSERT_EQUAL(saved.quantization(), QuantizedRows::quantization(format));
+
+    QuantizedRows mapped;
+    mapped.build(saved, format);
+    ASSERT_EQUAL(mapped.size_bytes(), built.size_bytes());
+    ASSERT_EQUAL(mapped.term_error(), built.term_error());
+    vector<double> expected(model.num_labels());
+    vector<double> actual(model.num_labels());
+    for (auto &words : QUERIES) {
+      built.score(words, expected);
+      mapped.score(words, actual);
+      ASSERT_SEQUENCE_EQUAL(actual, expected);
+    }
+
+    // a copy still reads the rows of the mapping
+    QuantizedRows copy = mapped;
+    copy.score({0, 1}, actual);
+    built.score({0, 1}, expected);
+    ASSERT_SEQUENCE_EQUAL(actual, expected);
+  }
+  remove(filename.c_str());
+}
+
+TEST_MAIN()
@@ -0,0 +1,315 @@
+#ifndef SCOREROWS_HPP
+#define SCOREROWS_HPP
+/* ScoreRows.hpp
+ *
+ * Dense per-word rows of a ModelFile's log-likelihoods, one entry per
+ * label, for scoring a post as a sum of rows. A post's scores start from
+ * the row of log-priors and add the row of each of its words in order, so
+ * every label still adds the same terms in the same order as the sparse
+ * tables, and the sums match bit for bit. Rows are added with AVX-512 or
+ * AVX2 when the CPU has them, and with a plain loop otherwise.
+ *
+ * The same dispatch adds the int8 and half-precision rows of
+ * QuantizedRows, widening each value to a double before adding it, so
+ * every instruction set gives the same sums as the plain loop.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "ModelFile.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCOREROWS_X86 1
+#include <immintrin.h>
+#endif
+
+class ScoreRows {
+public:
+  // Instruction set used by add(), add_int8() and add_half()
+  enum Simd { SCALAR, AVX2, AVX512 };
+
+  // MODIFIES: this
+  // EFFECTS : Builds the rows of model if they take at most max_bytes,
+  //           and returns whether they were built.
+  bool build(const ModelFile &model, size_t max_bytes) {
+    labels = model.num_labels();
+    size_t words = model.num_words();
+    table.clear();
+    if ((words + 2) * labels > max_bytes / sizeof(double)) {
+      return false;
+    }
+
+    table.resize((words + 2) * labels);
+    for (int label = 0; label < model.num_labels(); ++label) {
+      table[label] = model.log_prior(label);
+      table[labels + label] = model.unknown_log_likelihood();
+    }
+    for (size_t word = 0; word < words; ++word) {
+      double *row = &table[(word + 2) * labels];
+      for (size_t label = 0; label < labels; ++label) {
+        row[label] = model.fallback_log_likelihood(word);
+      }
+      for (uint64_t entry = model.entries_begin(word);
+           entry < model.entries_end(word); ++entry) {
+        row[model.entry_label(entry)] = model.entry_log_likelihood(entry);
+      }
+    }
+    return true;
+  }
+
+  // EFFECTS : Returns whether there are rows to score with.
+  bool empty() const {
+    return table.empty();
+  }
+
+  // REQUIRES: !empty()
+  // EFFECTS : Returns the row of log-priors.
+  const double * priors() const {
+    return table.data();
+  }
+
+  // REQUIRES: !empty(), word < number of words of the model
+  // EFFECTS : Returns the row of log-likelihoods of word, where word is
+  //           -1 for a word never seen in training.
+  const double * row(int word) const {
+    return &table[(word + 2) * labels];
+  }
+
+  // REQUIRES: scores and row have num_labels entries
+  // MODIFIES: scores
+  // EFFECTS : Adds row to scores, entry by entry.
+  static void add(double *scores, const double *row, size_t num_labels) {
+#ifdef SCOREROWS_X86
+    if (simd() == AVX512) {
+      add_avx512(scores, row, num_labels);
+      return;
+    }
+    if (simd() == AVX2) {
+      add_avx2(scores, row, num_labels);
+      return;
+    }
+#endif
+    add_scalar(scores, row, num_labels);
+  }
+
+  // REQUIRES: scores and row have num_labels entries
+  // MODIFIES: scores
+  // EFFECTS : Adds row of int8 values to scores, entry by entry.
+  static void add_int8(double *scores, const int8_t *row,
+                       size_t num_labels) {
+#ifdef SCOREROWS_X86
+    // a row shorter than a vector is all tail
+    if (num_labels < 8) {
+      add_scalar(scores, row, num_labels);
+      return;
+    }
+    if (simd() == AVX512) {
+      add_int8_avx512(scores, row, num_labels);
+      return;
+    }
+    if (simd() == AVX2) {
+      add_int8_avx2(scores, row, num_labels);
+      return;
+    }
+#endif
+    add_scalar(scores, row, num_labels);
+  }
+
+  // REQUIRES: scores and row have num_labels entries
+  // MODIFIES: scores
+  // EFFECTS : Adds row of half-precision floats, given by their bits, to
+  //           scores, entry by entry.
+  static void add_half(double *scores, const uint16_t *row,
+                       size_t num_labels) {
+#ifdef SCOREROWS_X86
+    // a row shorter than a vector is all tail
+    if (num_labels < 8) {
+      add_half_scalar(scores, row, num_labels);
+      return;
+    }
+    if (simd() == AVX512) {
+      add_half_avx512(scores, row, num_labels);
+      return;
+    }
+    if (simd() == AVX2) {
+      add_half_avx2(scores, row, num_labels);
+      return;
+    }
+#endif
+    add_half_scalar(scores, row, num_labels);
+  }
+
+  // EFFECTS : Returns the half-precision float with bits half.
+  static float from_half(uint16_t half) {
+    uint32_t sign = uint32_t(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0) {
+      float value = std::ldexp(float(mantissa), -24);
+      return sign ? -value : value;
+    }
+    uint32_t bits = exponent == 31
+      ? sign | 0x7f800000 | (mantissa << 13)
+      : sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // MODIFIES: the instruction set used by every ScoreRows
+  // EFFECTS : Uses at most limit, as far as the CPU supports it, and
+  //           returns the instruction set now in use.
+  static Simd limit_simd(Simd limit) {
+    simd() = std::min(limit, detect());
+    return simd();
+  }
+
+  // EFFECTS : Returns the instruction set used by add(), add_int8() and
+  //           add_half().
+  static Simd current_simd() {
+    return simd();
+  }
+
+private:
+  size_t labels = 0;
+
+  // priors, then the unknown-word row, then one row per word
+  std::vector<double> table;
+
+  static Simd & simd() {
+    static Simd chosen = detect();
+    return chosen;
+  }
+
+  // EFFECTS : Returns the widest instruction set this CPU supports.
+  static Simd detect() {
+#ifdef SCOREROWS_X86
+    if (__builtin_cpu_supports("avx512f")) {
+      return AVX512;
+    }
+    // the half kernels also need F16C, which came with AVX2 on every CPU
+    // so far but is its own flag
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+      return AVX2;
+    }
+#endif
+    return SCALAR;
+  }
+
+  template <typename Value>
+  static void add_scalar(double *scores, const Value *row, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      scores[i] += row[i];
+    }
+  }
+
+  static void add_half_scalar(double *scores, const uint16_t *row,
+                              size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      scores[i] += from_half(row[i]);
+    }
+  }
+
+#ifdef SCOREROWS_X86
+  __attribute__((target("avx2")))
+  static void add_avx2(double *scores, const double *row, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256d sum = _mm256_add_pd(_mm256_loadu_pd(scores + i),
+                                  _mm256_loadu_pd(row + i));
+      _mm256_storeu_pd(scores + i, sum);
+    }
+    for (; i < n; ++i) {
+      scores[i] += row[i];
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  static void add_avx512(double *scores, const double *row, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m512d sum = _mm512_add_pd(_mm512_loadu_pd(scores + i),
+                                  _mm512_loadu_pd(row + i));
+      _mm512_storeu_pd(scores + i, sum);
+    }
+    for (; i < n; ++i) {
+      scores[i] += row[i];
+    }
+  }
+
+  // The quantized kernels widen 8 or 16 values at a time to int32 or
+  // float, then to doubles, and add them as two halves.
+
+  __attribute__((target("avx2")))
+  static void add_int8_avx2(double *scores, const int8_t *row, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i wide = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i)));
+      __m256d low = _mm256_cvtepi32_pd(_mm256_castsi256_si128(wide));
+      __m256d high = _mm256_cvtepi32_pd(_mm256_extracti128_si256(wide, 1));
+      _mm256_storeu_pd(scores + i,
+                       _mm256_add_pd(_mm256_loadu_pd(scores + i), low));
+      _mm256_storeu_pd(scores + i + 4,
+                       _mm256_add_pd(_mm256_loadu_pd(scores + i + 4), high));
+    }
+    add_scalar(scores + i, row + i, n - i);
+  }
+
+  __attribute__((target("avx512f")))
+  static void add_int8_avx512(double *scores, const int8_t *row, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m512i wide = _mm512_cvtepi8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+      __m512d low = _mm512_cvtepi32_pd(_mm512_castsi512_si256(wide));
+      __m512d high = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(wide, 1));
+      _mm512_storeu_pd(scores + i,
+                       _mm512_add_pd(_mm512_loadu_pd(scores + i), low));
+      _mm512_storeu_pd(scores + i + 8,
+                       _mm512_add_pd(_mm512_loadu_pd(scores + i + 8), high));
+    }
+    add_scalar(scores + i, row + i, n - i);
+  }
+
+  __attribute__((target("avx2,f16c")))
+  static void add_half_avx2(double *scores, const uint16_t *row, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256 wide = _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+      __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(wide));
+      __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(wide, 1));
+      _mm256_storeu_pd(scores + i,
+                       _mm256_add_pd(_mm256_loadu_pd(scores + i), low));
+      _mm256_storeu_pd(scores + i + 4,
+                       _mm256_add_pd(_mm256_loadu_pd(scores + i + 4), high));
+    }
+    add_half_scalar(scores + i, row + i, n - i);
+  }
+
+  __attribute__((target("avx512f")))
+  static void add_half_avx512(double *scores, const uint16_t *row,
+                              size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m512 wide = _mm512_cvtph_ps(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i)));
+      __m512d low = _mm512_cvtps_pd(_mm512_castps512_ps256(wide));
+      __m512d high = _mm512_cvtps_pd(_mm256_castpd_ps(
+        _mm512_extractf64x4_pd(_mm512_castps_pd(wide), 1)));
+      _mm512_storeu_pd(scores + i,
+                       _mm512_add_pd(_mm512_loadu_pd(scores + i), low));
+      _mm512_storeu_pd(scores + i + 8,
+                       _mm512_add_pd(_mm512_loadu_pd(scores + i + 8), high));
+    }
+    add_half_scalar(scores + i, row + i, n - i);
+  }
+#endif
+};
+
+#endif // SCOREROWS_HPP
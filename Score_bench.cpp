@@ -0,0 +1,119 @@
+// Scoring microbenchmark on synthetic data with many labels. Compares
+// prediction from the sparse tables with dense score rows added by a
+// scalar loop, AVX2 and AVX-512, and checks that all of them predict the
+// same labels with the same scores. Also times sparse delta scoring with
+// and without early exit, which sum in another order, and int8 and fp16
+// quantized rows, and counts the posts where they predict another label
+// and the largest change of a predicted score.
+#include "Classifier.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int VOCABULARY = 5000;
+const int WORDS_PER_POST = 20;
+const int TRAIN_POSTS = 20000;
+const int TEST_POSTS = 5000;
+
+// EFFECTS return a post of random words, where low-numbered words are
+//         common and each label prefers its own band of words
+static string make_post(mt19937 &random, int label) {
+  geometric_distribution<int> common(0.01);
+  uniform_int_distribution<int> band(0, 49);
+  string post;
+  for (int i = 0; i < WORDS_PER_POST; ++i) {
+    int word = i % 2 ? common(random) % VOCABULARY
+                     : (label * 50 + band(random)) % VOCABULARY;
+    post += "w" + to_string(word) + " ";
+  }
+  return post;
+}
+
+// EFFECTS predict every post, several rounds, print throughput, and
+//         return the predictions of the last round
+static vector<pair<string, double>> bench(const string &name,
+                                          Classifier &classifier,
+                                          const vector<string> &posts) {
+  const int ROUNDS = 3;
+  vector<pair<string, double>> predictions(posts.size());
+  classifier.compute_most_probable_tag(posts[0]);  // build the tables
+  auto start = chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (size_t i = 0; i < posts.size(); ++i) {
+      predictions[i] = classifier.compute_most_probable_tag(posts[i]);
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "  " << left << setw(10) << name << right << fixed
+       << setprecision(1) << setw(10)
+       << posts.size() * ROUNDS / elapsed.count() / 1e3 << " kposts/s"
+       << endl;
+  return predictions;
+}
+
+int main() {
+  for (int num_labels : {4, 16, 64, 256}) {
+    mt19937 random(num_labels);
+    uniform_int_distribution<int> pick_label(0, num_labels - 1);
+    Classifier classifier;
+    for (int i = 0; i < TRAIN_POSTS; ++i) {
+      int label = pick_label(random);
+      classifier.train_model("label" + to_string(label),
+                             make_post(random, label));
+    }
+    vector<string> posts;
+    for (int i = 0; i < TEST_POSTS; ++i) {
+      posts.push_back(make_post(random, pick_label(random)));
+    }
+    cout << num_labels << " labels, " << classifier.get_vocabulary_size()
+         << " words:" << endl;
+
+    classifier.set_score_rows_limit(0);
+    auto expected = bench("sparse", classifier, posts);
+    classifier.set_score_rows_limit(SCORE_ROWS_LIMIT);
+    const pair<ScoreRows::Simd, const char *> simds[] = {
+      {ScoreRows::SCALAR, "scalar"},
+      {ScoreRows::AVX2, "avx2"},
+      {ScoreRows::AVX512, "avx512"},
+    };
+    for (auto &simd : simds) {
+      if (ScoreRows::limit_simd(simd.first) != simd.first) {
+        cout << "  " << simd.second << ": not supported" << endl;
+        continue;
+      }
+      if (bench(simd.second, classifier, posts) != expected) {
+        cout << "  " << simd.second << ": predictions differ" << endl;
+        return 1;
+      }
+    }
+    ScoreRows::limit_simd(ScoreRows::AVX512);
+
+    const pair<Scoring, const char *> modes[] = {
+      {Scoring::SPARSE, "delta"},
+      {Scoring::EARLY_EXIT, "early-exit"},
+      {Scoring::INT8, "int8"},
+      {Scoring::FP16, "fp16"},
+    };
+    for (auto &mode : modes) {
+      classifier.set_scoring(mode.first);
+      auto predictions = bench(mode.second, classifier, posts);
+      int changed = 0;
+      double error = 0;
+      for (size_t i = 0; i < posts.size(); ++i) {
+        changed += predictions[i].first != expected[i].first;
+        error = max(error, abs(predictions[i].second - expected[i].second));
+      }
+      cout << "    " << changed << " labels changed, score error up to "
+           << scientific << setprecision(2) << error << endl;
+    }
+    classifier.set_scoring(Scoring::EXACT);
+  }
+}
@@ -0,0 +1,132 @@
+// Load generator for main.exe --serve --socket PATH. Sends the content of
+// every post of a CSV file over one or more connections, keeping up to
+// --depth requests in flight on each, and prints throughput and request
+// latency percentiles.
+#include "csvstream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// EFFECTS return the content column of filename, one request line per
+//         post
+static vector<string> read_requests(const string &filename) {
+  csvstream csv(filename);
+  csvstream_batch batch;
+  vector<string> requests;
+  while (csv.read_batch(batch, 4096)) {
+    size_t content = batch.column_index("content");
+    for (size_t i = 0; i < batch.size(); ++i) {
+      string line(batch.value(content, i));
+      replace(line.begin(), line.end(), '\n', ' ');
+      requests.push_back(line + "\n");
+    }
+  }
+  return requests;
+}
+
+// EFFECTS return a connection to the server at path, or exit
+static int connect_to(const string &path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address),
+                        sizeof(address)) < 0) {
+    cerr << "Error connecting to " << path << endl;
+    exit(1);
+  }
+  return fd;
+}
+
+// MODIFIES latencies
+// EFFECTS send every request on a new connection to path, at most depth
+//         at a time, and append the latency of each in microseconds
+static void run_connection(const string &path, const vector<string> &requests,
+                           size_t depth, vector<double> &latencies) {
+  int fd = connect_to(path);
+  vector<Clock::time_point> sent(requests.size());
+  size_t next_send = 0;
+  size_t next_answer = 0;
+  char buffer[1 << 16];
+  while (next_answer < requests.size()) {
+    string batch;
+    while (next_send < requests.size() && next_send - next_answer < depth) {
+      batch += requests[next_send];
+      sent[next_send++] = Clock::now();
+    }
+    if (!batch.empty() && write(fd, batch.data(), batch.size()) !=
+                          ssize_t(batch.size())) {
+      cerr << "Error sending requests" << endl;
+      exit(1);
+    }
+    ssize_t count = read(fd, buffer, sizeof(buffer));
+    if (count <= 0) {
+      cerr << "Server hung up" << endl;
+      exit(1);
+    }
+    Clock::time_point now = Clock::now();
+    for (ssize_t i = 0; i < count; ++i) {
+      if (buffer[i] == '\n') {
+        chrono::duration<double, micro> latency = now - sent[next_answer++];
+        latencies.push_back(latency.count());
+      }
+    }
+  }
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    cout << "Usage: Serve_bench.exe SOCKET CSV_FILE [--depth N] "
+         << "[--connections N]" << endl;
+    return 1;
+  }
+  string path = argv[1];
+  size_t depth = 1;
+  int connections = 1;
+  for (int i = 3; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    if (arg == "--depth") {
+      depth = max(atoi(argv[i + 1]), 1);
+    } else if (arg == "--connections") {
+      connections = max(atoi(argv[i + 1]), 1);
+    }
+  }
+  vector<string> requests = read_requests(argv[2]);
+
+  vector<vector<double>> latencies(connections);
+  vector<thread> clients;
+  Clock::time_point start = Clock::now();
+  for (int c = 0; c < connections; ++c) {
+    clients.emplace_back([&, c]() {
+      run_connection(path, requests, depth, latencies[c]);
+    });
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+  chrono::duration<double> elapsed = Clock::now() - start;
+
+  vector<double> all;
+  for (auto &some : latencies) {
+    all.insert(all.end(), some.begin(), some.end());
+  }
+  sort(all.begin(), all.end());
+  cout << "depth " << depth << ", " << connections << " connection(s): "
+       << fixed << setprecision(1)
+       << all.size() / elapsed.count() / 1e3 << " krequests/s, latency p50 "
+       << all[all.size() / 2] << " us, p99 " << all[all.size() * 99 / 100]
+       << " us, max " << all.back() << " us" << endl;
+}
@@ -0,0 +1,76 @@
+#ifndef SHARDEDTRAINER_HPP
+#define SHARDEDTRAINER_HPP
+/* ShardedTrainer.hpp
+ *
+ * Trains a Classifier on several threads. Every batch of rows is cut into
+ * one contiguous slice per worker, and each worker trains its own shard: a
+ * thread-local Classifier with its own labels, vocabulary and counts. The
+ * shards are merged in shard order at the end, so the result does not
+ * depend on thread timing and its counts equal single-threaded training.
+ */
+
+#include <thread>
+#include <vector>
+#include "Classifier.hpp"
+
+class ShardedTrainer {
+public:
+  // REQUIRES: num_threads >= 1
+  // EFFECTS : Creates a trainer with one empty shard per thread.
+  explicit ShardedTrainer(int num_threads)
+    : shards(num_threads) {}
+
+  // EFFECTS : Waits for any batch still being trained.
+  ~ShardedTrainer() {
+    wait();
+  }
+
+  // REQUIRES: batch is not modified or destroyed until wait() returns
+  // MODIFIES: this
+  // EFFECTS : Starts training the shards on batch in the background.
+  template <typename Batch>
+  void start(const Batch &batch) {
+    wait();
+    size_t tag_column = batch.column_index("tag");
+    size_t content_column = batch.column_index("content");
+    size_t num_shards = shards.size();
+
+    for (size_t s = 0; s < num_shards; ++s) {
+      size_t first = batch.size() * s / num_shards;
+      size_t last = batch.size() * (s + 1) / num_shards;
+      Classifier &shard = shards[s];
+      workers.emplace_back([&batch, &shard, first, last, tag_column,
+                            content_column]() {
+        for (size_t i = first; i < last; ++i) {
+          shard.train_model(batch.value(tag_column, i),
+                            batch.value(content_column, i));
+        }
+      });
+    }
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Waits until the batch passed to start() is trained.
+  void wait() {
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+
+  // MODIFIES: this, classifier
+  // EFFECTS : Waits for training to finish and merges every shard into
+  //           classifier, in shard order.
+  void merge_into(Classifier &classifier) {
+    wait();
+    for (const auto &shard : shards) {
+      classifier.merge(shard);
+    }
+  }
+
+private:
+  std::vector<Classifier> shards;
+  std::vector<std::thread> workers;
+};
+
+#endif // SHARDEDTRAINER_HPP
@@ -0,0 +1,134 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+/* Tokenizer.hpp
+ *
+ * Splits text into its unique whitespace-delimited words without
+ * allocating. Words are string_views into the text, deduplicated with
+ * sort + unique, so they come out in the same order as a
+ * std::set<std::string> filled by reading the text with operator>>.
+ *
+ * ngrams() finds the runs of 1 to order consecutive words in the same
+ * pass, as hashes rolled forward one word at a time: the hash of the n
+ * words ending at a word is the hash of the n - 1 words ending at the word
+ * before, times an odd constant, plus the word's own hash. No n-gram is
+ * ever joined into a string; each comes with a view of its span of the
+ * text, whitespace included, for output that needs to show it.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class Tokenizer {
+public:
+  // Longest n-gram ngrams() finds
+  static const int MAX_ORDER = 3;
+
+  // An n-gram of a text: its hash, and the text from its first word to its
+  // last
+  struct NGram {
+    uint64_t hash;
+    std::string_view span;
+  };
+
+  // EFFECTS : Returns whether c separates words, matching std::isspace in
+  //           the "C" locale.
+  static bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Returns the unique words of text in sorted order. The views
+  //           point into text, and the vector is reused by the next call,
+  //           so once it has grown no call allocates.
+  const std::vector<std::string_view> & unique_words(std::string_view text) {
+    words.clear();
+    size_t i = 0;
+    size_t size = text.size();
+    while (i < size) {
+      while (i < size && is_space(text[i])) {
+        ++i;
+      }
+      size_t start = i;
+      while (i < size && !is_space(text[i])) {
+        ++i;
+      }
+      if (i > start) {
+        words.push_back(text.substr(start, i - start));
+      }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    return words;
+  }
+
+  // REQUIRES: 1 <= order <= MAX_ORDER
+  // MODIFIES: this
+  // EFFECTS : Returns every run of 1 to order consecutive words of text, in
+  //           the order they end, with repeats. A single word's hash is
+  //           mix(word_hash(word)). The vector is reused by the next call.
+  const std::vector<NGram> & ngrams(std::string_view text, int order) {
+    grams.clear();
+    // rolling[n - 1] and starts[n - 1] are the unmixed hash and the start
+    // of the n words ending at the last word, for n up to words seen
+    uint64_t rolling[MAX_ORDER];
+    size_t starts[MAX_ORDER];
+    int seen = 0;
+    size_t i = 0;
+    size_t size = text.size();
+    while (i < size) {
+      while (i < size && is_space(text[i])) {
+        ++i;
+      }
+      size_t start = i;
+      while (i < size && !is_space(text[i])) {
+        ++i;
+      }
+      if (i == start) {
+        break;
+      }
+      seen = std::min(seen + 1, order);
+      uint64_t word = word_hash(text.substr(start, i - start));
+      for (int n = seen; n > 1; --n) {
+        rolling[n - 1] = rolling[n - 2] * ROLLING_PRIME + word;
+        starts[n - 1] = starts[n - 2];
+      }
+      rolling[0] = word;
+      starts[0] = start;
+      for (int n = 0; n < seen; ++n) {
+        grams.push_back(NGram{mix(rolling[n]),
+                              text.substr(starts[n], i - starts[n])});
+      }
+    }
+    return grams;
+  }
+
+  // EFFECTS : Returns the FNV-1a hash of word.
+  static uint64_t word_hash(std::string_view word) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : word) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  // EFFECTS : Returns h mixed so that its low bits depend on all of its
+  //           bits.
+  static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+  }
+
+private:
+  // odd multiplier of the rolling hash
+  static constexpr uint64_t ROLLING_PRIME = 0x9e3779b97f4a7c15ull;
+
+  std::vector<std::string_view> words;
+  std::vector<NGram> grams;
+};
+
+#endif // TOKENIZER_HPP
@@ -0,0 +1,115 @@
+// Tokenizer microbenchmark over the bundled datasets. Compares the old
+// istringstream + std::set<string> approach with Tokenizer, and counts heap
+// allocations per post. Also times the rolling hashes of n-grams of each
+// order.
+#include "Tokenizer.hpp"
+#include "csvstream.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Count every heap allocation in the process
+static size_t allocations = 0;
+
+void * operator new(size_t size) {
+  ++allocations;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+// EFFECTS return the content column of filename
+static vector<string> read_posts(const string &filename) {
+  csvstream csv(filename);
+  csvstream_batch batch;
+  vector<string> posts;
+  while (csv.read_batch(batch, 4096)) {
+    size_t content = batch.column_index("content");
+    for (size_t i = 0; i < batch.size(); ++i) {
+      posts.push_back(string(batch.value(content, i)));
+    }
+  }
+  return posts;
+}
+
+// EFFECTS time tokenize over every post, several rounds, and print
+//         throughput and allocations per post
+template <typename Func>
+static void bench(const string &name, const vector<string> &posts,
+                  Func tokenize) {
+  const int ROUNDS = 5;
+  size_t bytes = 0;
+  for (const string &post : posts) bytes += post.size();
+
+  size_t words = 0;
+  tokenize(posts[0]);  // warm up reusable buffers
+  size_t start_allocations = allocations;
+  auto start = chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (const string &post : posts) {
+      words += tokenize(post);
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  double posts_done = double(posts.size()) * ROUNDS;
+
+  cout << "  " << left << setw(22) << name << right << fixed
+       << setprecision(1) << setw(8)
+       << bytes * ROUNDS / elapsed.count() / 1e6 << " MB/s"
+       << setw(10) << posts_done / elapsed.count() / 1e3 << " kposts/s"
+       << setprecision(2) << setw(8)
+       << (allocations - start_allocations) / posts_done << " allocs/post"
+       << "  (" << words / ROUNDS << " words)" << endl;
+}
+
+int main() {
+  vector<string> files = {
+    "w14-f15_instructor_student.csv",
+    "w16_instructor_student.csv",
+    "w16_projects_exam.csv",
+    "sp16_projects_exam.csv",
+  };
+
+  for (const string &file : files) {
+    vector<string> posts = read_posts(file);
+    cout << file << ": " << posts.size() << " posts" << endl;
+
+    bench("istringstream+set", posts, [](const string &post) {
+      istringstream source(post);
+      set<string> words;
+      string word;
+      while (source >> word) {
+        words.insert(word);
+      }
+      return words.size();
+    });
+
+    Tokenizer tokenizer;
+    bench("Tokenizer", posts, [&tokenizer](const string &post) {
+      return tokenizer.unique_words(post).size();
+    });
+
+    for (int order = 1; order <= Tokenizer::MAX_ORDER; ++order) {
+      bench("ngrams, n <= " + to_string(order), posts,
+            [&tokenizer, order](const string &post) {
+        return tokenizer.ngrams(post, order).size();
+      });
+    }
+  }
+}
@@ -0,0 +1,96 @@
+#include "Tokenizer.hpp"
+#include "unit_test_framework.hpp"
+#include <set>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// EFFECTS return the unique words of text the way operator>> splits them
+static vector<string> reference_words(const string &text) {
+  istringstream source(text);
+  set<string> words;
+  string word;
+  while (source >> word) {
+    words.insert(word);
+  }
+  return vector<string>(words.begin(), words.end());
+}
+
+// EFFECTS return the unique words of text from a Tokenizer
+static vector<string> tokenizer_words(Tokenizer &tokenizer,
+                                      const string &text) {
+  vector<string> words;
+  for (string_view word : tokenizer.unique_words(text)) {
+    words.push_back(string(word));
+  }
+  return words;
+}
+
+TEST(tokenizer_empty) {
+  Tokenizer tokenizer;
+  ASSERT_TRUE(tokenizer.unique_words("").empty());
+  ASSERT_TRUE(tokenizer.unique_words(" \t\r\n ").empty());
+}
+
+TEST(tokenizer_matches_istringstream) {
+  Tokenizer tokenizer;
+  vector<string> texts = {
+    "the quick brown fox jumps over the lazy dog",
+    "  leading and trailing  ",
+    "tabs\tand\nnewlines\r\nand\vvertical\ftabs",
+    "Case case CASE case",
+    "punctuation, stays; attached! to words.",
+    "\xc3\xa9t\xc3\xa9 caf\xc3\xa9 \x80high bytes",
+    "a",
+  };
+  for (const string &text : texts) {
+    ASSERT_EQUAL(tokenizer_words(tokenizer, text), reference_words(text));
+  }
+}
+
+TEST(tokenizer_views_point_into_text) {
+  Tokenizer tokenizer;
+  string text = "bower upcard bower";
+  const vector<string_view> &words = tokenizer.unique_words(text);
+  ASSERT_EQUAL(words.size(), 2u);
+  ASSERT_EQUAL(words[0], "bower");
+  ASSERT_TRUE(words[1].data() == text.data() + 6);
+}
+
+TEST(tokenizer_ngrams_roll_over_words) {
+  Tokenizer tokenizer;
+  string text = " left  bower\tleft bower ";
+  const vector<Tokenizer::NGram> &grams = tokenizer.ngrams(text, 3);
+  // each word, then the runs of 2 and 3 words ending at it
+  vector<string> spans = {"left", "bower", "left  bower", "left",
+                          "bower\tleft", "left  bower\tleft", "bower",
+                          "left bower", "bower\tleft bower"};
+  ASSERT_EQUAL(grams.size(), spans.size());
+  for (size_t i = 0; i < grams.size(); ++i) {
+    ASSERT_EQUAL(string(grams[i].span), spans[i]);
+  }
+  ASSERT_EQUAL(grams[0].hash,
+               Tokenizer::mix(Tokenizer::word_hash("left")));
+
+  // an n-gram hashes the same wherever it occurs and however it is spaced,
+  // and differently from its words in another order
+  ASSERT_EQUAL(grams[2].hash, grams[7].hash);
+  ASSERT_EQUAL(grams[0].hash, grams[3].hash);
+  ASSERT_TRUE(grams[2].hash != grams[4].hash);
+  ASSERT_TRUE(grams[2].hash != grams[0].hash);
+  ASSERT_TRUE(grams[5].hash != grams[8].hash);
+}
+
+TEST(tokenizer_ngrams_of_order_one_are_words) {
+  Tokenizer tokenizer;
+  ASSERT_TRUE(tokenizer.ngrams("", 3).empty());
+  ASSERT_TRUE(tokenizer.ngrams(" \n ", 2).empty());
+  const vector<Tokenizer::NGram> &grams = tokenizer.ngrams("a b a", 1);
+  ASSERT_EQUAL(grams.size(), 3u);
+  ASSERT_EQUAL(grams[1].span, "b");
+  ASSERT_EQUAL(grams[0].hash, grams[2].hash);
+  ASSERT_EQUAL(tokenizer.ngrams("one", 3).size(), 1u);
+}
+
+TEST_MAIN()
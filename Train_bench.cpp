@@ -0,0 +1,91 @@
+// Training microbenchmark over the bundled datasets. Times training a
+// HashedClassifier on single words, then on runs of up to 2 and 3 words,
+// and prints the training throughput of each n-gram order and its overhead
+// over single words. The exact Classifier is timed for reference.
+#include "HashedClassifier.hpp"
+#include "csvstream.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+const int BITS = 20;
+
+// EFFECTS return the tag and content columns of filename
+static vector<pair<string, string>> read_posts(const string &filename) {
+  csvstream csv(filename);
+  csvstream_batch batch;
+  vector<pair<string, string>> posts;
+  while (csv.read_batch(batch, 4096)) {
+    size_t tag = batch.column_index("tag");
+    size_t content = batch.column_index("content");
+    for (size_t i = 0; i < batch.size(); ++i) {
+      posts.emplace_back(string(batch.value(tag, i)),
+                         string(batch.value(content, i)));
+    }
+  }
+  return posts;
+}
+
+// EFFECTS train a new classifier from make() on every post, several
+//         rounds, print throughput and its overhead over baseline, and
+//         return the throughput. Creating the classifiers is not timed.
+template <typename Make>
+static double bench(const string &name,
+                    const vector<pair<string, string>> &posts,
+                    double baseline, Make make) {
+  const int ROUNDS = 5;
+  size_t bytes = 0;
+  for (auto &post : posts) bytes += post.second.size();
+
+  vector<decltype(make())> classifiers;
+  for (int r = 0; r < ROUNDS; ++r) {
+    classifiers.push_back(make());
+  }
+  auto start = chrono::steady_clock::now();
+  for (auto &classifier : classifiers) {
+    for (auto &post : posts) {
+      classifier.train_model(post.first, post.second);
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  double rate = posts.size() * ROUNDS / elapsed.count() / 1e3;
+
+  cout << "  " << left << setw(14) << name << right << fixed
+       << setprecision(1) << setw(8)
+       << bytes * ROUNDS / elapsed.count() / 1e6 << " MB/s"
+       << setw(10) << rate << " kposts/s";
+  if (baseline > 0) {
+    cout << setw(8) << (baseline / rate - 1) * 100 << "% overhead";
+  }
+  cout << endl;
+  return rate;
+}
+
+int main() {
+  vector<string> files = {
+    "w14-f15_instructor_student.csv",
+    "w16_projects_exam.csv",
+  };
+
+  for (const string &file : files) {
+    vector<pair<string, string>> posts = read_posts(file);
+    cout << file << ": " << posts.size() << " posts" << endl;
+
+    bench("Classifier", posts, 0, [] { return Classifier(); });
+    double unigrams = 0;
+    for (int order = 1; order <= Tokenizer::MAX_ORDER; ++order) {
+      double rate = bench("hashed, n <= " + to_string(order), posts,
+                          unigrams, [order] {
+        return HashedClassifier(BITS, order);
+      });
+      if (order == 1) {
+        unigrams = rate;
+      }
+    }
+  }
+}
@@ -0,0 +1,408 @@
+/* -*- mode: c++ -*- */
+#ifndef CSVCACHE_HPP
+#define CSVCACHE_HPP
+/* csvcache.hpp
+ *
+ * A binary columnar cache of a parsed CSV file.  The first time a CSV file
+ * is opened it is parsed with csvstream and written to a cache file holding
+ * one offsets array and one char buffer per column.  Later opens mmap the
+ * cache and skip CSV parsing entirely.  The cache is rebuilt automatically
+ * when the source file's size, modification time or contents change.
+ * Opening a cache hashes the source, one sequential read that is still far
+ * cheaper than parsing it.  A caller that trusts the source's size and
+ * modification time can opt out of the hash: it is then computed only
+ * when the modification time is too close to when the cache was written
+ * to tell whether the source changed since.  Sources rewritten with their
+ * old size and mtime, for example by touch -d, rsync -t or cp -p, then
+ * keep their stale cache.
+ *
+ * Cache file layout.  All integers are native-endian uint64 unless noted.
+ *
+ *   header     magic "P5CSVC\0\0", uint32 version, uint32 reserved,
+ *              source size, source mtime (ns), source FNV-1a hash,
+ *              number of columns, number of rows
+ *   directory  per column: name offset, name size, offsets offset,
+ *              data offset, data size
+ *   payload    per column: offsets array (num_rows + 1 entries), then name
+ *              and data bytes, each section 8-byte aligned
+ */
+
+#include "csvstream.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Identity of a source file, used to decide whether a cache is stale.  hash
+// is 0 until it is computed.
+struct csvcache_source_info {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  uint64_t hash = 0;
+};
+
+
+// csvcache interface
+class csvcache {
+public:
+  // Open the cache for source_file at cache_file, rebuilding it first if it
+  // is missing, unreadable or stale.  Throws csvstream_exception if the
+  // source cannot be parsed or the cache cannot be written.  async is
+  // passed to csvstream when the source has to be parsed.  If trust_mtime,
+  // a cache whose source has the same size and an mtime well before the
+  // cache was written is used without hashing the source.
+  csvcache(const std::string &source_file, const std::string &cache_file,
+           bool async=false, bool trust_mtime=false);
+
+  // Unmap the cache
+  ~csvcache();
+
+  // Return true if the cache was (re)built by the constructor
+  bool rebuilt() const { return was_rebuilt; }
+
+  // Return number of rows
+  size_t size() const { return num_rows; }
+
+  // Return number of columns
+  size_t num_columns() const { return columns.size(); }
+
+  // Return index of the column with this name.  Throws csvstream_exception
+  // if there is no such column.
+  size_t column_index(const std::string &name) const;
+
+  // Return the value in a column and row.  The view points into the mapped
+  // file and is valid for the lifetime of this object.
+  std::string_view value(size_t column, size_t row) const {
+    const Column &col = columns[column];
+    return std::string_view(col.data + col.offsets[row],
+                            col.offsets[row + 1] - col.offsets[row]);
+  }
+
+  // Return the size and modification time of a file on disk, with hash 0.
+  // Throws csvstream_exception if the file cannot be read.
+  static csvcache_source_info source_info(const std::string &filename);
+
+  // Return the FNV-1a hash of the contents of a file.  Throws
+  // csvstream_exception if the file cannot be read.
+  static uint64_t source_hash(const std::string &filename);
+
+private:
+  struct Column {
+    std::string_view name;
+    const uint64_t *offsets;
+    const char *data;
+  };
+
+  const char *map_base = nullptr;
+  size_t map_size = 0;
+  size_t num_rows = 0;
+  std::vector<Column> columns;
+  bool was_rebuilt = false;
+
+  // Map cache_file and check it against source_file, whose size and mtime
+  // are in source, setting source.hash if it has to be computed, which is
+  // skipped for an old enough mtime if trust_mtime.  Return false, leaving
+  // nothing mapped, if the file is missing, malformed or stale.
+  bool open_cache(const std::string &cache_file,
+                  const std::string &source_file,
+                  csvcache_source_info &source, bool trust_mtime);
+
+  // Release the mapping, if any
+  void unmap();
+
+  // Disable copying
+  csvcache(const csvcache &);
+  csvcache & operator= (const csvcache &);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation
+
+// Fixed-size header at the start of a cache file
+struct csvcache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t source_hash;
+  uint64_t num_columns;
+  uint64_t num_rows;
+};
+
+
+// One directory entry per column, following the header
+struct csvcache_entry {
+  uint64_t name_offset;
+  uint64_t name_size;
+  uint64_t offsets_offset;
+  uint64_t data_offset;
+  uint64_t data_size;
+};
+
+
+static const char CSVCACHE_MAGIC[8] = {'P', '5', 'C', 'S', 'V', 'C', 0, 0};
+static const uint32_t CSVCACHE_VERSION = 1;
+
+// A source modified less than this long before its cache was written may
+// have changed since without a new size or mtime, on file systems with
+// coarse timestamps, so it is hashed even if the caller trusts mtimes
+static const int64_t CSVCACHE_RACY_NS = 2000000000;
+
+
+// Return 64-bit FNV-1a hash of bytes, continuing from hash
+static uint64_t csvcache_fnv1a(const char *bytes, size_t size,
+                               uint64_t hash=14695981039346656037ull) {
+  for (size_t i=0; i<size; ++i) {
+    hash ^= static_cast<unsigned char>(bytes[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+
+// Round size up to a multiple of 8
+static uint64_t csvcache_align(uint64_t size) {
+  return (size + 7) & ~uint64_t(7);
+}
+
+
+// Return the modification time of st in nanoseconds
+static int64_t csvcache_mtime_ns(const struct stat &st) {
+#ifdef __APPLE__
+  return int64_t(st.st_mtimespec.tv_sec) * 1000000000 +
+    st.st_mtimespec.tv_nsec;
+#else
+  return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+
+csvcache_source_info csvcache::source_info(const std::string &filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0 || access(filename.c_str(), R_OK)) {
+    throw csvstream_exception("Error opening file: " + filename);
+  }
+  csvcache_source_info info;
+  info.size = st.st_size;
+  info.mtime_ns = csvcache_mtime_ns(st);
+  return info;
+}
+
+
+uint64_t csvcache::source_hash(const std::string &filename) {
+  std::ifstream fin(filename.c_str(), std::ios::binary);
+  if (!fin.is_open()) {
+    throw csvstream_exception("Error opening file: " + filename);
+  }
+  std::vector<char> buffer(1 << 16);
+  uint64_t hash = csvcache_fnv1a(nullptr, 0);
+  while (fin.read(buffer.data(), buffer.size()) || fin.gcount() > 0) {
+    hash = csvcache_fnv1a(buffer.data(), fin.gcount(), hash);
+  }
+  return hash;
+}
+
+
+// Parse source_file and write its columns to cache_file
+static void csvcache_write(const std::string &source_file,
+                           const std::string &cache_file,
+                           const csvcache_source_info &source,
+                           bool async) {
+  // Gather every row, column by column
+  csvstream csv(source_file, ',', true, async);
+  csvstream_batch part;
+  std::vector<std::string> header = csv.getheader();
+  std::vector<std::string> data(header.size());
+  std::vector<std::vector<uint64_t>> offsets(header.size(),
+                                             std::vector<uint64_t>(1, 0));
+  while (csv.read_batch(part, 4096)) {
+    for (size_t c=0; c<header.size(); ++c) {
+      for (size_t r=0; r<part.size(); ++r) {
+        data[c] += part.value(c, r);
+        offsets[c].push_back(data[c].size());
+      }
+    }
+  }
+  uint64_t num_rows = offsets.empty() ? 0 : offsets[0].size() - 1;
+
+  // Lay out the directory and payload
+  std::vector<csvcache_entry> entries(header.size());
+  uint64_t pos = sizeof(csvcache_header) +
+    header.size() * sizeof(csvcache_entry);
+  for (size_t c=0; c<header.size(); ++c) {
+    entries[c].offsets_offset = pos;
+    pos += (num_rows + 1) * sizeof(uint64_t);
+    entries[c].name_offset = pos;
+    entries[c].name_size = header[c].size();
+    pos = csvcache_align(pos + header[c].size());
+    entries[c].data_offset = pos;
+    entries[c].data_size = data[c].size();
+    pos = csvcache_align(pos + data[c].size());
+  }
+
+  csvcache_header head;
+  std::memset(&head, 0, sizeof(head));
+  std::memcpy(head.magic, CSVCACHE_MAGIC, sizeof(head.magic));
+  head.version = CSVCACHE_VERSION;
+  head.source_size = source.size;
+  head.source_mtime_ns = source.mtime_ns;
+  head.source_hash = source.hash;
+  head.num_columns = header.size();
+  head.num_rows = num_rows;
+
+  // Write to a temporary file of this rebuild only and rename, so readers
+  // never see a partial cache, and concurrent rebuilds never share a file
+  std::string tmp_file = cache_file + ".XXXXXX";
+  int fd = mkstemp(&tmp_file[0]);
+  if (fd < 0) {
+    throw csvstream_exception("Error writing cache: " + cache_file);
+  }
+  fchmod(fd, 0644);
+  close(fd);
+  std::ofstream fout(tmp_file.c_str(), std::ios::binary | std::ios::trunc);
+  const char zeros[8] = {0};
+  fout.write(reinterpret_cast<const char *>(&head), sizeof(head));
+  fout.write(reinterpret_cast<const char *>(entries.data()),
+             entries.size() * sizeof(csvcache_entry));
+  for (size_t c=0; c<header.size(); ++c) {
+    fout.write(reinterpret_cast<const char *>(offsets[c].data()),
+               offsets[c].size() * sizeof(uint64_t));
+    fout.write(header[c].data(), header[c].size());
+    fout.write(zeros, entries[c].data_offset - entries[c].name_offset -
+               header[c].size());
+    fout.write(data[c].data(), data[c].size());
+    fout.write(zeros, csvcache_align(data[c].size()) - data[c].size());
+  }
+  fout.close();
+  if (!fout || std::rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    throw csvstream_exception("Error writing cache: " + cache_file);
+  }
+}
+
+
+csvcache::csvcache(const std::string &source_file,
+                   const std::string &cache_file,
+                   bool async, bool trust_mtime) {
+  csvcache_source_info source = source_info(source_file);
+  if (open_cache(cache_file, source_file, source, trust_mtime)) return;
+
+  if (!source.hash) source.hash = source_hash(source_file);
+  csvcache_write(source_file, cache_file, source, async);
+  was_rebuilt = true;
+  if (!open_cache(cache_file, source_file, source, false)) {
+    throw csvstream_exception("Error reading cache: " + cache_file);
+  }
+}
+
+
+csvcache::~csvcache() {
+  unmap();
+}
+
+
+size_t csvcache::column_index(const std::string &name) const {
+  for (size_t i=0; i<columns.size(); ++i) {
+    if (columns[i].name == name) return i;
+  }
+  throw csvstream_exception("No such column: " + name);
+}
+
+
+bool csvcache::open_cache(const std::string &cache_file,
+                          const std::string &source_file,
+                          csvcache_source_info &source, bool trust_mtime) {
+  int fd = open(cache_file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(csvcache_header)) {
+    close(fd);
+    return false;
+  }
+  map_size = st.st_size;
+  int64_t written_ns = csvcache_mtime_ns(st);
+  void *base = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return false;
+  map_base = static_cast<const char *>(base);
+
+  // Check the header against the source file
+  const csvcache_header *head =
+    reinterpret_cast<const csvcache_header *>(map_base);
+  uint64_t directory_end = sizeof(csvcache_header) +
+    head->num_columns * sizeof(csvcache_entry);
+  if (std::memcmp(head->magic, CSVCACHE_MAGIC, sizeof(head->magic)) != 0 ||
+      head->version != CSVCACHE_VERSION ||
+      head->source_size != source.size ||
+      head->source_mtime_ns != source.mtime_ns ||
+      head->num_columns > map_size / sizeof(csvcache_entry) ||
+      directory_end > map_size) {
+    unmap();
+    return false;
+  }
+
+  // A source can change without a new size or mtime; only a caller that
+  // trusts mtimes skips the hash, and not for a racily recent one
+  if (!trust_mtime || written_ns - source.mtime_ns < CSVCACHE_RACY_NS) {
+    if (!source.hash) source.hash = source_hash(source_file);
+    if (head->source_hash != source.hash) {
+      unmap();
+      return false;
+    }
+  }
+
+  // Check that every section lies inside the file
+  num_rows = head->num_rows;
+  const csvcache_entry *entries =
+    reinterpret_cast<const csvcache_entry *>(head + 1);
+  for (uint64_t c=0; c<head->num_columns; ++c) {
+    const csvcache_entry &entry = entries[c];
+    uint64_t offsets_size = (num_rows + 1) * sizeof(uint64_t);
+    if (num_rows >= map_size / sizeof(uint64_t) ||
+        entry.offsets_offset + offsets_size > map_size ||
+        entry.name_offset + entry.name_size > map_size ||
+        entry.data_offset + entry.data_size > map_size) {
+      unmap();
+      return false;
+    }
+    Column col;
+    col.name = std::string_view(map_base + entry.name_offset,
+                                entry.name_size);
+    col.offsets =
+      reinterpret_cast<const uint64_t *>(map_base + entry.offsets_offset);
+    col.data = map_base + entry.data_offset;
+    // Every value must lie inside the column's data
+    bool valid = col.offsets[0] == 0 &&
+      col.offsets[num_rows] <= entry.data_size;
+    for (uint64_t r=0; valid && r<num_rows; ++r) {
+      valid = col.offsets[r] <= col.offsets[r + 1];
+    }
+    if (!valid) {
+      unmap();
+      return false;
+    }
+    columns.push_back(col);
+  }
+  return true;
+}
+
+
+void csvcache::unmap() {
+  if (map_base) munmap(const_cast<char *>(map_base), map_size);
+  map_base = nullptr;
+  map_size = 0;
+  num_rows = 0;
+  columns.clear();
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include "csvcache.hpp"
+#include "unit_test_framework.hpp"
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace std;
+
+static const string SOURCE = "/tmp/csvcache_tests.csv";
+static const string CACHE = SOURCE + ".colcache";
+
+// EFFECTS write text to SOURCE
+static void write_source(const string &text) {
+  ofstream fout(SOURCE.c_str(), ios::binary | ios::trunc);
+  fout << text;
+  fout.close();
+}
+
+// EFFECTS set the modification time of filename to seconds since epoch
+static void set_mtime(const string &filename, long seconds) {
+  struct timeval times[2];
+  times[0].tv_sec = times[1].tv_sec = seconds;
+  times[0].tv_usec = times[1].tv_usec = 0;
+  utimes(filename.c_str(), times);
+}
+
+TEST(cache_matches_csv) {
+  write_source("tag,content\neuchre,\"left, bower\"\ncalculator,big three\n");
+  remove(CACHE.c_str());
+
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.size(), 2u);
+  ASSERT_EQUAL(cache.num_columns(), 2u);
+  size_t content = cache.column_index("content");
+  ASSERT_EQUAL(cache.value(content, 0), "left, bower");
+  ASSERT_EQUAL(cache.value(cache.column_index("tag"), 1), "calculator");
+}
+
+TEST(cache_is_reused) {
+  write_source("tag,content\neuchre,upcard\n");
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_FALSE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(1, 0), "upcard");
+}
+
+TEST(cache_invalidated_by_size) {
+  write_source("tag,content\neuchre,upcard\n");
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  write_source("tag,content\neuchre,upcard\ncalculator,stack\n");
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.size(), 2u);
+}
+
+TEST(cache_invalidated_by_mtime) {
+  write_source("tag,content\neuchre,upcard\n");
+  set_mtime(SOURCE, 1000000);
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  set_mtime(SOURCE, 2000000);
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+}
+
+TEST(cache_invalidated_by_hash) {
+  // A source written just before its cache may change again within the
+  // same timestamp
+  write_source("tag,content\neuchre,upcard\n");
+  struct stat st;
+  stat(SOURCE.c_str(), &st);
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  // Same size and mtime, different contents
+  write_source("tag,content\neuchre,dealer\n");
+  struct timespec times[2] = {st.st_mtim, st.st_mtim};
+  utimensat(AT_FDCWD, SOURCE.c_str(), times, 0);
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(1, 0), "dealer");
+}
+
+TEST(cache_invalidated_by_hash_with_old_mtime) {
+  // Rewriting a source with its old size and mtime, as touch -d, rsync -t
+  // and cp -p can, still rebuilds the cache
+  write_source("tag,content\neuchre,upcard\n");
+  set_mtime(SOURCE, 1000000);
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  write_source("tag,content\neuchre,dealer\n");
+  set_mtime(SOURCE, 1000000);
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(1, 0), "dealer");
+}
+
+TEST(cache_trusting_mtime_skips_hash) {
+  // Only a caller that opts in trusts an old mtime without hashing
+  write_source("tag,content\neuchre,upcard\n");
+  set_mtime(SOURCE, 1000000);
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  write_source("tag,content\neuchre,dealer\n");
+  set_mtime(SOURCE, 1000000);
+  csvcache cache(SOURCE, CACHE, false, true);
+  ASSERT_FALSE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(1, 0), "upcard");
+}
+
+TEST(cache_with_decreasing_offsets_is_rebuilt) {
+  write_source("tag,content\neuchre,upcard\ncalculator,stack\n");
+  set_mtime(SOURCE, 1000000);
+  remove(CACHE.c_str());
+  { csvcache cache(SOURCE, CACHE); }
+
+  // Swap the first column's offsets of rows 1 and 2, so row 1 would end
+  // before it starts
+  uint64_t offsets[2];
+  size_t first_offsets = sizeof(csvcache_header) + 2 * sizeof(csvcache_entry);
+  fstream file(CACHE.c_str(), ios::binary | ios::in | ios::out);
+  file.seekg(first_offsets + sizeof(uint64_t));
+  file.read(reinterpret_cast<char *>(offsets), sizeof(offsets));
+  swap(offsets[0], offsets[1]);
+  file.seekp(first_offsets + sizeof(uint64_t));
+  file.write(reinterpret_cast<const char *>(offsets), sizeof(offsets));
+  file.close();
+
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(0, 1), "calculator");
+}
+
+TEST(corrupt_cache_is_rebuilt) {
+  write_source("tag,content\neuchre,upcard\n");
+  ofstream fout(CACHE.c_str(), ios::binary | ios::trunc);
+  fout << "not a cache";
+  fout.close();
+
+  csvcache cache(SOURCE, CACHE);
+  ASSERT_TRUE(cache.rebuilt());
+  ASSERT_EQUAL(cache.value(0, 0), "euchre");
+}
+
+TEST_MAIN()
@@ -18,6 +18,25 @@
 #include <map>
 #include <regex>
 #include <exception>
+#include <string_view>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+
+// Compressed input support is enabled at build time, see the Makefile
+#ifdef CSVSTREAM_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CSVSTREAM_ZSTD
+#include <zstd.h>
+#endif
 
 
 // A custom exception type
@@ -31,14 +50,235 @@ public:
 };
 
 
+// Read-ahead statistics, see csvstream_readahead
+struct csvstream_readahead_stats {
+  // Seconds the parser spent waiting for the reader thread to fill a buffer
+  double parser_stall_seconds = 0;
+
+  // Seconds the reader thread spent waiting for the parser to free a buffer
+  double reader_stall_seconds = 0;
+
+  // Number of buffers filled and bytes read by the reader thread
+  size_t buffers_filled = 0;
+  size_t bytes_read = 0;
+};
+
+
+// A stream buffer that reads ahead from another stream on a background
+// thread.  The reader thread fills a ring of buffers while the parser
+// consumes the previous one, overlapping I/O with parsing.
+class csvstream_readahead : public std::streambuf {
+public:
+  // Start reading from src.  src must outlive this object.
+  csvstream_readahead(std::istream &src,
+                      size_t num_buffers=4,
+                      size_t buffer_size=1<<16);
+
+  // Stop and join the reader thread.  If the reader is blocked on a read
+  // from src, this waits until that read returns.
+  ~csvstream_readahead();
+
+  // Return a snapshot of the stall counters
+  csvstream_readahead_stats stats() const;
+
+protected:
+  int_type underflow() override;
+
+private:
+  struct Slot {
+    std::vector<char> data;
+    size_t size = 0;
+    bool full = false;
+  };
+
+  std::istream &src;
+  std::vector<Slot> ring;
+  size_t buffer_size;
+
+  // Slot the parser reads next, and whether it currently holds that slot
+  size_t read_slot = 0;
+  bool holding = false;
+
+  // Slot the reader thread fills next
+  size_t write_slot = 0;
+
+  // Set by the destructor, and by the reader thread when src is exhausted
+  bool stop = false;
+  bool done = false;
+
+  csvstream_readahead_stats counters;
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::thread reader;
+
+  // Body of the reader thread
+  void run();
+
+  // Disable copying
+  csvstream_readahead(const csvstream_readahead &);
+  csvstream_readahead & operator= (const csvstream_readahead &);
+};
+
+
+// Compression formats recognized by csvstream_decompress
+enum class csvstream_compression { NONE, GZIP, ZSTD };
+
+
+// A stream buffer that decompresses gzip or zstd data read from another
+// stream, using bounded input and output buffers.  The format is detected
+// from its magic number.  Data without a recognized magic number is passed
+// through unchanged.
+class csvstream_decompress : public std::streambuf {
+public:
+  // Start reading from src.  src must outlive this object.  Throws
+  // csvstream_exception if src is compressed in a format this build does
+  // not support.
+  csvstream_decompress(std::istream &src, size_t buffer_size=1<<16);
+
+  ~csvstream_decompress();
+
+  // Return the detected format
+  csvstream_compression format() const { return compression; }
+
+  // Return a description of the first decoding error, or "" if none.  After
+  // an error the stream reports end of input.
+  const std::string & error() const { return error_msg; }
+
+protected:
+  int_type underflow() override;
+
+private:
+  std::istream &src;
+  std::vector<char> in_buf;
+  std::vector<char> out_buf;
+  size_t in_pos = 0;
+  size_t in_len = 0;
+  csvstream_compression compression = csvstream_compression::NONE;
+
+  // Whether the last decode() filled out_buf, so more output may be pending
+  bool output_full = false;
+
+  // Whether the decoder is at the end of a gzip member or zstd frame
+  bool frame_done = false;
+
+  std::string error_msg;
+
+#ifdef CSVSTREAM_ZLIB
+  z_stream zs;
+#endif
+#ifdef CSVSTREAM_ZSTD
+  ZSTD_DStream *zds = nullptr;
+#endif
+
+  // Refill in_buf from src.  Return false at end of input.
+  bool fill_input();
+
+  // Decompress from in_buf into out_buf.  Return bytes produced.
+  size_t decode();
+
+  // Disable copying
+  csvstream_decompress(const csvstream_decompress &);
+  csvstream_decompress & operator= (const csvstream_decompress &);
+};
+
+
+// One column of a csvstream_batch.  Values are stored back to back in data,
+// and value i spans data[offsets[i], offsets[i+1]).
+struct csvstream_column {
+  std::string name;
+  std::string data;
+  std::vector<size_t> offsets;
+};
+
+
+// A batch of rows stored by column, in the style of Apache Arrow.  Reusing
+// one batch across calls to csvstream::read_batch() reuses its buffers, so
+// steady-state reads do not allocate.
+class csvstream_batch {
+public:
+  // Return number of rows
+  size_t size() const { return num_rows; }
+
+  // Return number of columns
+  size_t num_columns() const { return columns.size(); }
+
+  // Return column i
+  const csvstream_column & column(size_t i) const { return columns[i]; }
+
+  // Return index of the column with this name.  Throws csvstream_exception
+  // if there is no such column.
+  size_t column_index(const std::string &name) const;
+
+  // Return the value in a column and row.  The view is valid until the
+  // batch is cleared or refilled.
+  std::string_view value(size_t column, size_t row) const {
+    const csvstream_column &col = columns[column];
+    return std::string_view(col.data).substr(
+      col.offsets[row], col.offsets[row + 1] - col.offsets[row]);
+  }
+
+  // Remove all rows, keeping column names and buffer capacity
+  void clear();
+
+private:
+  friend class csvstream;
+  std::vector<csvstream_column> columns;
+  size_t num_rows = 0;
+};
+
+
+// Byte offset of the start of every data row of a CSV file, built in one
+// pass.  Row numbers count data rows from 0 and exclude the header.
+class csvstream_index {
+public:
+  // Scan is from its current position to the end.  Row boundaries follow
+  // the same quoting, escaping and line ending rules as the parser.
+  static csvstream_index build(std::istream &is);
+
+  // Return number of rows
+  size_t size() const { return offsets.size(); }
+
+  // Return byte offset of the start of a row.  offset(size()) is the end of
+  // the last row.
+  uint64_t offset(size_t row) const {
+    return row < offsets.size() ? offsets[row] : end;
+  }
+
+  // Return k distinct row numbers drawn uniformly at random, in increasing
+  // order.  Returns every row when k >= size().
+  std::vector<size_t> sample(size_t k, uint64_t seed) const;
+
+  // Split the rows into k contiguous ranges [first, last) of nearly equal
+  // size, for parallel workers.  Ranges may be empty when k > size().
+  std::vector<std::pair<size_t, size_t> > split(size_t k) const;
+
+  // Save to filename, tagged with the size and modification time of source.
+  // Throws csvstream_exception if the file cannot be written.
+  void save(const std::string &filename, const std::string &source) const;
+
+  // Load from filename.  Return false if the file is missing, malformed, or
+  // was saved for a different version of source.
+  bool load(const std::string &filename, const std::string &source);
+
+private:
+  std::vector<uint64_t> offsets;
+  uint64_t end = 0;
+};
+
+
 // csvstream interface
 class csvstream {
 public:
   // Constructor from filename. Throws csvstream_exception if open fails.
-  csvstream(const std::string &filename, char delimiter=',', bool strict=true);
+  // When async=true, a background thread reads ahead from the file while
+  // rows are parsed.  gzip and zstd input is decompressed on the fly, on the
+  // read-ahead thread when async=true.
+  csvstream(const std::string &filename, char delimiter=',', bool strict=true,
+            bool async=false);
 
   // Constructor from stream
-  csvstream(std::istream &is, char delimiter=',', bool strict=true);
+  csvstream(std::istream &is, char delimiter=',', bool strict=true,
+            bool async=false);
 
   // Destructor
   ~csvstream();
@@ -58,6 +298,35 @@ public:
   // header.
   csvstream & operator>> (std::vector<std::pair<std::string, std::string> >& row);
 
+  // Read up to n rows into batch, replacing its contents.  Returns the
+  // number of rows read, which is 0 at end of input.  Throws
+  // csvstream_exception if the number of items in a row does not match the
+  // header.
+  size_t read_batch(csvstream_batch &batch, size_t n);
+
+  // Read up to n rows into a new batch
+  csvstream_batch read_batch(size_t n);
+
+  // Return read-ahead stall counters.  All zero unless async=true.
+  csvstream_readahead_stats readahead_stats() const;
+
+  // Build a row-offset index in one pass over the data rows, leaving the
+  // read position unchanged.  When persist=true and the stream was opened
+  // from a file, reuse FILENAME.rowidx if it is up to date, otherwise save
+  // the new index there.  Throws csvstream_exception if the stream is not
+  // seekable, including when async=true.
+  void build_index(bool persist=false);
+
+  // Return true if build_index() has been called
+  bool has_index() const { return indexed; }
+
+  // Return the row-offset index.  REQUIRES has_index().
+  const csvstream_index & index() const { return row_index; }
+
+  // Move the read position to the start of data row n, counting from 0.
+  // Throws csvstream_exception if there is no index or n is past the end.
+  void seek_row(size_t n);
+
 private:
   // Filename.  Used for error messages.
   std::string filename;
@@ -68,6 +337,18 @@ private:
   // Stream in CSV format
   std::istream &is;
 
+  // Decompressor over is and the stream wrapping it, for compressed input
+  std::unique_ptr<csvstream_decompress> decoder;
+  std::unique_ptr<std::istream> decoder_is;
+
+  // Read-ahead buffer and the stream wrapping it, when async=true
+  std::unique_ptr<csvstream_readahead> readahead;
+  std::unique_ptr<std::istream> readahead_is;
+
+  // Stream the parser reads from: is itself, or the last of decoder_is and
+  // readahead_is
+  std::istream *in;
+
   // Delimiter between columns
   char delimiter;
 
@@ -82,9 +363,28 @@ private:
   // Store header column names
   std::vector<std::string> header;
 
+  // Row-offset index and whether it has been built
+  csvstream_index row_index;
+  bool indexed = false;
+
+  // Offset of the first data row, or -1 if the stream is not seekable
+  std::streamoff data_start = -1;
+
   // Process header, the first line of the file
   void read_header();
 
+  // Decompress is if it starts with a gzip or zstd magic number
+  void start_decompress();
+
+  // Start a read-ahead thread over the stream the parser reads from
+  void start_readahead();
+
+  // Throw csvstream_exception if decompression failed
+  void check_decode_error() const;
+
+  // Throw csvstream_exception unless a row of this size matches the header
+  void check_row_size(size_t size) const;
+
   // Disable copying because copying streams is bad!
   csvstream(const csvstream &);
   csvstream & operator= (const csvstream &);
@@ -94,15 +394,64 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 // Implementation
 
-// Read and tokenize one line from a stream
-static bool read_csv_line(std::istream &is,
-                          std::vector<std::string> &data,
-                          char delimiter
-                          ) {
+// Collects the fields of one line as strings
+class csvstream_vector_sink {
+public:
+  csvstream_vector_sink(std::vector<std::string> &data) : data(data) {
+    // Add entry for first token, start with empty string
+    data.clear();
+    data.push_back(std::string());
+  }
+  void append(char c) { data.back() += c; }
+  void new_field() { data.push_back(""); }
+private:
+  std::vector<std::string> &data;
+};
+
+
+// Appends the fields of one line to the columns of a batch.  Fields past
+// the last column are dropped.
+class csvstream_batch_sink {
+public:
+  csvstream_batch_sink(std::vector<csvstream_column> &columns)
+    : columns(columns), field(0) {}
+  void begin_row() { field = 0; }
+  void append(char c) {
+    if (field < columns.size()) columns[field].data += c;
+  }
+  void new_field() {
+    if (field < columns.size()) {
+      columns[field].offsets.push_back(columns[field].data.size());
+    }
+    ++field;
+  }
 
-  // Add entry for first token, start with empty string
-  data.clear();
-  data.push_back(std::string());
+  // Close the last field, pad missing fields with empty values and return
+  // the number of fields read
+  size_t end_row() {
+    new_field();
+    size_t count = field;
+    while (field < columns.size()) new_field();
+    return count;
+  }
+
+  // Discard a partially appended row, leaving num_rows rows
+  void rollback(size_t num_rows) {
+    for (auto &col : columns) {
+      col.offsets.resize(num_rows + 1);
+      col.data.resize(col.offsets.back());
+    }
+  }
+private:
+  std::vector<csvstream_column> &columns;
+  size_t field;
+};
+
+
+// Read and tokenize one line from a stream, passing characters and field
+// boundaries to sink
+template <typename Sink>
+static bool read_csv_fields(std::istream &is, Sink &sink, char delimiter) {
 
   // Process one character at a time
   char c = '\0';
@@ -127,10 +476,10 @@ static bool read_csv_line(std::istream &is,
         state = QUOTED;
       } else if (c == '\\') { //note this checks for a single backslash char
         state = UNQUOTED_ESCAPED;
-        data.back() += c;
+        sink.append(c);
       } else if (c == delimiter) {
         // If you see a delimiter, then start a new field with an empty string
-        data.push_back("");
+        sink.new_field();
       } else if (c == '\n' || c == '\r') {
         // If you see a line ending *and it's not within a quoted token*, stop
         // parsing the line.  Works for UNIX (\n) and OSX (\r) line endings.
@@ -138,13 +487,13 @@ static bool read_csv_line(std::istream &is,
         state = END;
       } else {
         // Append character to current token
-        data.back() += c;
+        sink.append(c);
       }
       break;
 
     case UNQUOTED_ESCAPED:
       // If a character is escaped, add it no matter what.
-      data.back() += c;
+      sink.append(c);
       state = UNQUOTED;
       break;
 
@@ -154,16 +503,16 @@ static bool read_csv_line(std::istream &is,
         state = UNQUOTED;
       } else if (c == '\\') {
         state = QUOTED_ESCAPED;
-        data.back() += c;
+        sink.append(c);
       } else {
         // Append character to current token
-        data.back() += c;
+        sink.append(c);
       }
       break;
 
     case QUOTED_ESCAPED:
       // If a character is escaped, add it no matter what.
-      data.back() += c;
+      sink.append(c);
       state = QUOTED;
       break;
 
@@ -199,9 +548,138 @@ static bool read_csv_line(std::istream &is,
 }
 
 
-csvstream::csvstream(const std::string &filename, char delimiter, bool strict)
+// Read and tokenize one line from a stream
+static bool read_csv_line(std::istream &is,
+                          std::vector<std::string> &data,
+                          char delimiter
+                          ) {
+  csvstream_vector_sink sink(data);
+  return read_csv_fields(is, sink, delimiter);
+}
+
+
+size_t csvstream_batch::column_index(const std::string &name) const {
+  for (size_t i=0; i<columns.size(); ++i) {
+    if (columns[i].name == name) return i;
+  }
+  throw csvstream_exception("No such column: " + name);
+}
+
+
+void csvstream_batch::clear() {
+  for (auto &col : columns) {
+    col.data.clear();
+    col.offsets.assign(1, 0);
+  }
+  num_rows = 0;
+}
+
+
+csvstream_readahead::csvstream_readahead(std::istream &src,
+                                         size_t num_buffers,
+                                         size_t buffer_size)
+  : src(src),
+    ring(num_buffers < 2 ? 2 : num_buffers),
+    buffer_size(buffer_size) {
+  for (auto &slot : ring) slot.data.resize(buffer_size);
+  reader = std::thread(&csvstream_readahead::run, this);
+}
+
+
+csvstream_readahead::~csvstream_readahead() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  cv.notify_all();
+  reader.join();
+}
+
+
+csvstream_readahead_stats csvstream_readahead::stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return counters;
+}
+
+
+// Return seconds elapsed since start
+static double csvstream_seconds_since(
+  std::chrono::steady_clock::time_point start
+) {
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+
+csvstream_readahead::int_type csvstream_readahead::underflow() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // Hand the buffer we just finished back to the reader thread
+  if (holding) {
+    ring[read_slot].full = false;
+    read_slot = (read_slot + 1) % ring.size();
+    holding = false;
+    cv.notify_all();
+  }
+
+  // Wait for the reader thread to fill the next buffer
+  if (!ring[read_slot].full && !done) {
+    auto start = std::chrono::steady_clock::now();
+    cv.wait(lock, [this]{ return ring[read_slot].full || done; });
+    counters.parser_stall_seconds += csvstream_seconds_since(start);
+  }
+
+  // Buffers are filled in order, so an empty slot after the reader is done
+  // means end of input
+  if (!ring[read_slot].full) return traits_type::eof();
+
+  Slot &slot = ring[read_slot];
+  holding = true;
+  setg(slot.data.data(), slot.data.data(), slot.data.data() + slot.size);
+  return traits_type::to_int_type(*gptr());
+}
+
+
+void csvstream_readahead::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop) {
+    // Wait for the parser to free the next buffer
+    if (ring[write_slot].full) {
+      auto start = std::chrono::steady_clock::now();
+      cv.wait(lock, [this]{ return !ring[write_slot].full || stop; });
+      counters.reader_stall_seconds += csvstream_seconds_since(start);
+      if (stop) break;
+    }
+
+    // The parser never touches a slot that is not full, so fill it unlocked
+    Slot &slot = ring[write_slot];
+    lock.unlock();
+    src.read(slot.data.data(), buffer_size);
+    size_t count = src.gcount();
+    bool more = static_cast<bool>(src);
+    lock.lock();
+
+    if (count > 0) {
+      slot.size = count;
+      slot.full = true;
+      write_slot = (write_slot + 1) % ring.size();
+      counters.buffers_filled += 1;
+      counters.bytes_read += count;
+    }
+    cv.notify_all();
+    if (!more) break;
+  }
+  done = true;
+  cv.notify_all();
+}
+
+
+csvstream::csvstream(const std::string &filename, char delimiter, bool strict,
+                     bool async)
   : filename(filename),
     is(fin),
+    in(&fin),
     delimiter(delimiter),
     strict(strict),
     line_no(0) {
@@ -212,28 +690,206 @@ csvstream::csvstream(const std::string &filename, char delimiter, bool strict)
     throw csvstream_exception("Error opening file: " + filename);
   }
 
+  // Decompress and read ahead in the background if requested
+  start_decompress();
+  if (async) start_readahead();
+
   // Process header
   read_header();
 }
 
 
-csvstream::csvstream(std::istream &is, char delimiter, bool strict)
+csvstream::csvstream(std::istream &is, char delimiter, bool strict,
+                     bool async)
   : filename("[no filename]"),
     is(is),
+    in(&is),
     delimiter(delimiter),
     strict(strict),
     line_no(0) {
+  start_decompress();
+  if (async) start_readahead();
   read_header();
 }
 
 
 csvstream::~csvstream() {
+  // Stop the reader thread before releasing the streams it reads from
+  readahead_is.reset();
+  readahead.reset();
+  decoder_is.reset();
+  decoder.reset();
   if (fin.is_open()) fin.close();
 }
 
 
 csvstream::operator bool() const {
-  return static_cast<bool>(is);
+  return static_cast<bool>(*in);
+}
+
+
+csvstream_readahead_stats csvstream::readahead_stats() const {
+  if (!readahead) return csvstream_readahead_stats();
+  return readahead->stats();
+}
+
+
+void csvstream::start_decompress() {
+  // Plain CSV can start with '(', the first byte of the zstd magic number,
+  // so a seekable stream is checked for the whole magic number and stays
+  // seekable unless it is compressed.  A stream that cannot seek back only
+  // has its first byte checked, and a plain one starting with 0x1f or '('
+  // passes through the decompressor unchanged.
+  int c = is.peek();
+  if (c != 0x1f && c != 0x28) return;
+  std::streampos start = is.tellg();
+  if (start != std::streampos(-1)) {
+    unsigned char magic[4] = {0, 0, 0, 0};
+    is.read(reinterpret_cast<char *>(magic), sizeof(magic));
+    is.clear();
+    is.seekg(start);
+    bool gzip = magic[0] == 0x1f && magic[1] == 0x8b;
+    bool zstd = magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd;
+    if (!gzip && !zstd) return;
+  }
+
+  decoder.reset(new csvstream_decompress(is));
+  decoder_is.reset(new std::istream(decoder.get()));
+  in = decoder_is.get();
+}
+
+
+void csvstream::start_readahead() {
+  readahead.reset(new csvstream_readahead(*in));
+  readahead_is.reset(new std::istream(readahead.get()));
+  in = readahead_is.get();
+}
+
+
+void csvstream::check_decode_error() const {
+  if (decoder && !decoder->error().empty()) {
+    throw csvstream_exception(decoder->error() + ": " + filename);
+  }
+}
+
+
+csvstream_decompress::csvstream_decompress(std::istream &src,
+                                           size_t buffer_size)
+  : src(src), in_buf(buffer_size), out_buf(buffer_size) {
+  fill_input();
+  const unsigned char *magic =
+    reinterpret_cast<const unsigned char *>(in_buf.data());
+  if (in_len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+    compression = csvstream_compression::GZIP;
+  } else if (in_len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+             magic[2] == 0x2f && magic[3] == 0xfd) {
+    compression = csvstream_compression::ZSTD;
+  }
+
+  if (compression == csvstream_compression::GZIP) {
+#ifdef CSVSTREAM_ZLIB
+    std::memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+      throw csvstream_exception("Error initializing zlib");
+    }
+#else
+    throw csvstream_exception("gzip input requires CSVSTREAM_ZLIB");
+#endif
+  } else if (compression == csvstream_compression::ZSTD) {
+#ifdef CSVSTREAM_ZSTD
+    zds = ZSTD_createDStream();
+    if (!zds) throw csvstream_exception("Error initializing zstd");
+#else
+    throw csvstream_exception("zstd input requires CSVSTREAM_ZSTD");
+#endif
+  }
+}
+
+
+csvstream_decompress::~csvstream_decompress() {
+#ifdef CSVSTREAM_ZLIB
+  if (compression == csvstream_compression::GZIP) inflateEnd(&zs);
+#endif
+#ifdef CSVSTREAM_ZSTD
+  if (zds) ZSTD_freeDStream(zds);
+#endif
+}
+
+
+bool csvstream_decompress::fill_input() {
+  src.read(in_buf.data(), in_buf.size());
+  in_len = src.gcount();
+  in_pos = 0;
+  return in_len > 0;
+}
+
+
+csvstream_decompress::int_type csvstream_decompress::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+  // Uncompressed data is handed out straight from the input buffer
+  if (compression == csvstream_compression::NONE) {
+    if (in_pos == in_len && !fill_input()) return traits_type::eof();
+    setg(in_buf.data(), in_buf.data() + in_pos, in_buf.data() + in_len);
+    in_pos = in_len;
+    return traits_type::to_int_type(*gptr());
+  }
+
+  while (error_msg.empty()) {
+    if (in_pos == in_len && !output_full && !fill_input()) {
+      if (!frame_done) error_msg = "Truncated compressed input";
+      break;
+    }
+    size_t produced = decode();
+    output_full = produced == out_buf.size();
+    if (produced > 0) {
+      setg(out_buf.data(), out_buf.data(), out_buf.data() + produced);
+      return traits_type::to_int_type(*gptr());
+    }
+  }
+  return traits_type::eof();
+}
+
+
+size_t csvstream_decompress::decode() {
+#ifdef CSVSTREAM_ZLIB
+  if (compression == csvstream_compression::GZIP) {
+    // Concatenated gzip members decode as one stream
+    if (frame_done && in_pos < in_len) {
+      inflateReset(&zs);
+      frame_done = false;
+    }
+    zs.next_in = reinterpret_cast<Bytef *>(in_buf.data() + in_pos);
+    zs.avail_in = in_len - in_pos;
+    zs.next_out = reinterpret_cast<Bytef *>(out_buf.data());
+    zs.avail_out = out_buf.size();
+    int ret = inflate(&zs, Z_NO_FLUSH);
+    in_pos = in_len - zs.avail_in;
+    if (ret == Z_STREAM_END) {
+      frame_done = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      error_msg = std::string("gzip error: ") + (zs.msg ? zs.msg : "corrupt");
+    }
+    return out_buf.size() - zs.avail_out;
+  }
+#endif
+#ifdef CSVSTREAM_ZSTD
+  if (compression == csvstream_compression::ZSTD) {
+    ZSTD_inBuffer input = { in_buf.data(), in_len, in_pos };
+    ZSTD_outBuffer output = { out_buf.data(), out_buf.size(), 0 };
+    size_t ret = ZSTD_decompressStream(zds, &output, &input);
+    in_pos = input.pos;
+    if (ZSTD_isError(ret)) {
+      error_msg = std::string("zstd error: ") + ZSTD_getErrorName(ret);
+    } else {
+      // 0 means a frame is complete and fully flushed
+      frame_done = ret == 0;
+    }
+    return output.pos;
+  }
+#endif
+  return 0;
 }
 
 
@@ -248,7 +904,10 @@ csvstream & csvstream::operator>> (std::map<std::string, std::string>& row) {
 
   // Read one line from stream, bail out if we're at the end
   std::vector<std::string> data;
-  if (!read_csv_line(is, data, delimiter)) return *this;
+  if (!read_csv_line(*in, data, delimiter)) {
+    check_decode_error();
+    return *this;
+  }
   line_no += 1;
 
   // When strict mode is disabled, coerce the length of the data.  If data is
@@ -284,7 +943,10 @@ csvstream & csvstream::operator>> (std::vector<std::pair<std::string, std::strin
 
   // Read one line from stream, bail out if we're at the end
   std::vector<std::string> data;
-  if (!read_csv_line(is, data, delimiter)) return *this;
+  if (!read_csv_line(*in, data, delimiter)) {
+    check_decode_error();
+    return *this;
+  }
   line_no += 1;
 
   // When strict mode is disabled, coerce the length of the data.  If data is
@@ -313,11 +975,243 @@ csvstream & csvstream::operator>> (std::vector<std::pair<std::string, std::strin
 }
 
 
+size_t csvstream::read_batch(csvstream_batch &batch, size_t n) {
+  // Match batch columns to the header, keeping buffers when they already do
+  if (batch.columns.size() != header.size()) {
+    batch.columns.resize(header.size());
+  }
+  for (size_t i=0; i<header.size(); ++i) {
+    batch.columns[i].name = header[i];
+  }
+  batch.clear();
+  // Reserve for typical batch sizes; huge n grows the offsets as needed
+  size_t expected = n < 4096 ? n : 4096;
+  for (auto &col : batch.columns) col.offsets.reserve(expected + 1);
+
+  csvstream_batch_sink sink(batch.columns);
+  while (batch.num_rows < n) {
+    sink.begin_row();
+    if (!read_csv_fields(*in, sink, delimiter)) {
+      sink.rollback(batch.num_rows);
+      check_decode_error();
+      break;
+    }
+    line_no += 1;
+
+    size_t size = sink.end_row();
+    if (strict && size != header.size()) {
+      sink.rollback(batch.num_rows);
+      check_row_size(size);
+    }
+    batch.num_rows += 1;
+  }
+  return batch.num_rows;
+}
+
+
+csvstream_batch csvstream::read_batch(size_t n) {
+  csvstream_batch batch;
+  read_batch(batch, n);
+  return batch;
+}
+
+
+void csvstream::check_row_size(size_t size) const {
+  if (size != header.size()) {
+    auto msg = "Number of items in row does not match header. " +
+      filename + ":L" + std::to_string(line_no) + " " +
+      "header.size() = " + std::to_string(header.size()) + " " +
+      "row.size() = " + std::to_string(size) + " "
+      ;
+    throw csvstream_exception(msg);
+  }
+}
+
+
 void csvstream::read_header() {
   // read first line, which is the header
-  if (!read_csv_line(is, header, delimiter)) {
+  if (!read_csv_line(*in, header, delimiter)) {
+    check_decode_error();
     throw csvstream_exception("error reading header");
   }
+  if (in == &is) data_start = is.tellg();
+}
+
+
+csvstream_index csvstream_index::build(std::istream &is) {
+  csvstream_index index;
+  enum State {BEGIN, QUOTED, QUOTED_ESCAPED, UNQUOTED, UNQUOTED_ESCAPED, END};
+  State state = BEGIN;
+  uint64_t pos = is.tellg();
+  std::vector<char> buffer(1 << 16);
+
+  while (is.read(buffer.data(), buffer.size()) || is.gcount() > 0) {
+    size_t count = is.gcount();
+    for (size_t i=0; i<count; ++i, ++pos) {
+      char c = buffer[i];
+
+      // A row ends after its line ending, plus the \n of a \r\n pair
+      if (state == END) {
+        state = BEGIN;
+        if (c == '\n') continue;
+      }
+
+      switch (state) {
+      case BEGIN:
+        index.offsets.push_back(pos);
+        state = UNQUOTED;
+        #if __GNUG__ && __GNUC__ >= 7
+        [[fallthrough]];
+        #endif
+      case UNQUOTED:
+        if (c == '"') state = QUOTED;
+        else if (c == '\\') state = UNQUOTED_ESCAPED;
+        else if (c == '\n' || c == '\r') state = END;
+        break;
+      case UNQUOTED_ESCAPED:
+        state = UNQUOTED;
+        break;
+      case QUOTED:
+        if (c == '"') state = UNQUOTED;
+        else if (c == '\\') state = QUOTED_ESCAPED;
+        break;
+      case QUOTED_ESCAPED:
+        state = QUOTED;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  index.end = pos;
+  return index;
+}
+
+
+std::vector<size_t> csvstream_index::sample(size_t k, uint64_t seed) const {
+  size_t n = size();
+  std::vector<size_t> rows;
+  if (k >= n) {
+    for (size_t i=0; i<n; ++i) rows.push_back(i);
+    return rows;
+  }
+
+  // Floyd's algorithm draws k distinct values with exactly k random numbers
+  std::mt19937_64 rng(seed);
+  std::vector<bool> chosen(n, false);
+  for (size_t j=n-k; j<n; ++j) {
+    size_t t = std::uniform_int_distribution<size_t>(0, j)(rng);
+    size_t pick = chosen[t] ? j : t;
+    chosen[pick] = true;
+    rows.push_back(pick);
+  }
+  std::sort(rows.begin(), rows.end());
+  return rows;
+}
+
+
+std::vector<std::pair<size_t, size_t> >
+csvstream_index::split(size_t k) const {
+  std::vector<std::pair<size_t, size_t> > ranges;
+  size_t first = 0;
+  for (size_t i=0; i<k; ++i) {
+    size_t last = first + size() / k + (i < size() % k ? 1 : 0);
+    ranges.push_back(std::make_pair(first, last));
+    first = last;
+  }
+  return ranges;
+}
+
+
+// Identify a version of a file by its size and modification time
+static std::pair<uint64_t, int64_t>
+csvstream_file_version(const std::string &filename) {
+  std::error_code error;
+  uint64_t size = std::filesystem::file_size(filename, error);
+  if (error) return std::make_pair(0, 0);
+  auto mtime = std::filesystem::last_write_time(filename, error);
+  if (error) return std::make_pair(0, 0);
+  return std::make_pair(size, int64_t(mtime.time_since_epoch().count()));
+}
+
+
+static const char CSVSTREAM_INDEX_MAGIC[8] = {'P','5','R','O','W','I','D','X'};
+
+
+void csvstream_index::save(const std::string &filename,
+                           const std::string &source) const {
+  auto version = csvstream_file_version(source);
+  uint64_t num_rows = offsets.size();
+  std::ofstream fout(filename.c_str(), std::ios::binary | std::ios::trunc);
+  fout.write(CSVSTREAM_INDEX_MAGIC, sizeof(CSVSTREAM_INDEX_MAGIC));
+  fout.write(reinterpret_cast<const char *>(&version.first), 8);
+  fout.write(reinterpret_cast<const char *>(&version.second), 8);
+  fout.write(reinterpret_cast<const char *>(&num_rows), 8);
+  fout.write(reinterpret_cast<const char *>(&end), 8);
+  fout.write(reinterpret_cast<const char *>(offsets.data()), num_rows * 8);
+  if (!fout) throw csvstream_exception("Error writing index: " + filename);
+}
+
+
+bool csvstream_index::load(const std::string &filename,
+                           const std::string &source) {
+  std::ifstream fin(filename.c_str(), std::ios::binary);
+  char magic[sizeof(CSVSTREAM_INDEX_MAGIC)];
+  std::pair<uint64_t, int64_t> version;
+  uint64_t num_rows = 0;
+  fin.read(magic, sizeof(magic));
+  fin.read(reinterpret_cast<char *>(&version.first), 8);
+  fin.read(reinterpret_cast<char *>(&version.second), 8);
+  fin.read(reinterpret_cast<char *>(&num_rows), 8);
+  fin.read(reinterpret_cast<char *>(&end), 8);
+  if (!fin ||
+      !std::equal(magic, magic + sizeof(magic), CSVSTREAM_INDEX_MAGIC) ||
+      version != csvstream_file_version(source) ||
+      num_rows > version.first) {
+    return false;
+  }
+  offsets.resize(num_rows);
+  fin.read(reinterpret_cast<char *>(offsets.data()), num_rows * 8);
+  return static_cast<bool>(fin);
+}
+
+
+void csvstream::build_index(bool persist) {
+  if (in != &is || data_start < 0) {
+    throw csvstream_exception("Stream is not seekable: " + filename);
+  }
+
+  std::string index_file = filename + ".rowidx";
+  persist = persist && fin.is_open();
+  if (persist && row_index.load(index_file, filename)) {
+    indexed = true;
+    return;
+  }
+
+  // Scan from the first data row, then return to where we were
+  is.clear();
+  std::streamoff here = is.tellg();
+  is.seekg(data_start);
+  row_index = csvstream_index::build(is);
+  is.clear();
+  is.seekg(here);
+  indexed = true;
+
+  if (persist) row_index.save(index_file, filename);
+}
+
+
+void csvstream::seek_row(size_t n) {
+  if (!indexed) {
+    throw csvstream_exception("seek_row() requires build_index()");
+  }
+  if (n > row_index.size()) {
+    throw csvstream_exception("Row " + std::to_string(n) + " past end of " +
+                              filename);
+  }
+  is.clear();
+  is.seekg(row_index.offset(n));
+  line_no = n;
 }
 
 #endif
@@ -0,0 +1,339 @@
+#include "csvstream.hpp"
+#include "unit_test_framework.hpp"
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// EFFECTS return every row of csv, keyed by column name
+static vector<map<string, string>> read_all(csvstream &csv) {
+  vector<map<string, string>> rows;
+  map<string, string> row;
+  while (csv >> row) {
+    rows.push_back(row);
+  }
+  return rows;
+}
+
+static const string SMALL_CSV =
+  "tag,content\n"
+  "euchre,can the upcard ever be the left bower\n"
+  "calculator,\"how to assert, rational invariants\"\r\n"
+  "euchre,anyone want to play some euchre";
+
+TEST(readahead_copies_source_exactly) {
+  string text;
+  for (int i = 0; i < 1000; ++i) {
+    text += to_string(i) + (i % 7 ? "," : "\n");
+  }
+  istringstream source(text);
+
+  // Tiny buffers force many hand-offs between reader and parser
+  csvstream_readahead readahead(source, 2, 5);
+  istream in(&readahead);
+  string copy((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  ASSERT_EQUAL(copy, text);
+
+  csvstream_readahead_stats stats = readahead.stats();
+  ASSERT_EQUAL(stats.bytes_read, text.size());
+  ASSERT_TRUE(stats.buffers_filled >= text.size() / 5);
+}
+
+TEST(readahead_empty_source) {
+  istringstream source("");
+  csvstream_readahead readahead(source);
+  istream in(&readahead);
+  ASSERT_EQUAL(in.get(), char_traits<char>::eof());
+}
+
+TEST(async_rows_match_sync_rows) {
+  istringstream sync_source(SMALL_CSV);
+  csvstream sync_csv(sync_source);
+  istringstream async_source(SMALL_CSV);
+  csvstream async_csv(async_source, ',', true, true);
+
+  auto expected = read_all(sync_csv);
+  auto actual = read_all(async_csv);
+  ASSERT_EQUAL(expected.size(), 3u);
+  ASSERT_TRUE(actual == expected);
+  ASSERT_EQUAL(expected[1]["content"], "how to assert, rational invariants");
+  ASSERT_EQUAL(async_csv.readahead_stats().bytes_read, SMALL_CSV.size());
+}
+
+TEST(sync_reports_no_readahead) {
+  istringstream source(SMALL_CSV);
+  csvstream csv(source);
+  read_all(csv);
+  ASSERT_EQUAL(csv.readahead_stats().buffers_filled, 0u);
+}
+
+TEST(read_batch_columns) {
+  istringstream source(SMALL_CSV);
+  csvstream csv(source);
+  csvstream_batch batch;
+
+  ASSERT_EQUAL(csv.read_batch(batch, 2), 2u);
+  ASSERT_EQUAL(batch.num_columns(), 2u);
+  size_t tag = batch.column_index("tag");
+  size_t content = batch.column_index("content");
+  ASSERT_EQUAL(batch.value(tag, 0), "euchre");
+  ASSERT_EQUAL(batch.value(content, 1), "how to assert, rational invariants");
+
+  // Offsets index into one contiguous buffer per column
+  const csvstream_column &tags = batch.column(tag);
+  ASSERT_EQUAL(tags.data, "euchrecalculator");
+  ASSERT_EQUAL(tags.offsets.size(), 3u);
+
+  // Refilling the batch replaces its rows
+  ASSERT_EQUAL(csv.read_batch(batch, 2), 1u);
+  ASSERT_EQUAL(batch.value(content, 0), "anyone want to play some euchre");
+  ASSERT_EQUAL(csv.read_batch(batch, 2), 0u);
+  ASSERT_EQUAL(batch.size(), 0u);
+}
+
+TEST(read_batch_matches_row_reads) {
+  istringstream row_source(SMALL_CSV);
+  csvstream row_csv(row_source);
+  auto rows = read_all(row_csv);
+
+  istringstream batch_source(SMALL_CSV);
+  csvstream batch_csv(batch_source);
+  csvstream_batch batch = batch_csv.read_batch(100);
+  ASSERT_EQUAL(batch.size(), rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    ASSERT_EQUAL(batch.value(0, i), rows[i]["tag"]);
+    ASSERT_EQUAL(batch.value(1, i), rows[i]["content"]);
+  }
+}
+
+TEST(read_batch_strict_row_size) {
+  istringstream source("a,b\n1,2\n3\n");
+  csvstream csv(source);
+  csvstream_batch batch;
+  ASSERT_EQUAL(csv.read_batch(batch, 1), 1u);
+  bool thrown = false;
+  try {
+    csv.read_batch(batch, 1);
+  } catch (const csvstream_exception &) {
+    thrown = true;
+  }
+  ASSERT_TRUE(thrown);
+}
+
+TEST(read_batch_lenient_row_size) {
+  istringstream source("a,b\n1,2,3\n4\n");
+  csvstream csv(source, ',', false);
+  csvstream_batch batch = csv.read_batch(10);
+  ASSERT_EQUAL(batch.size(), 2u);
+  ASSERT_EQUAL(batch.value(1, 0), "2");
+  ASSERT_EQUAL(batch.value(0, 1), "4");
+  ASSERT_EQUAL(batch.value(1, 1), "");
+}
+
+static const string INDEX_CSV =
+  "tag,content\n"
+  "a,\"quoted\nnewline\"\r\n"
+  "b,escaped \\\" quote\r"
+  "c,plain\n"
+  "d,\"x,y\"";
+
+TEST(seek_row_matches_sequential_rows) {
+  istringstream sequential_source(INDEX_CSV);
+  csvstream sequential(sequential_source);
+  auto rows = read_all(sequential);
+  ASSERT_EQUAL(rows.size(), 4u);
+
+  istringstream source(INDEX_CSV);
+  csvstream csv(source);
+  csv.build_index();
+  ASSERT_EQUAL(csv.index().size(), rows.size());
+  ASSERT_EQUAL(csv.index().offset(4), INDEX_CSV.size());
+
+  // Visit rows out of order
+  map<string, string> row;
+  for (size_t n : {2u, 0u, 3u, 1u}) {
+    csv.seek_row(n);
+    csv >> row;
+    ASSERT_TRUE(row == rows[n]);
+  }
+}
+
+TEST(build_index_keeps_read_position) {
+  istringstream source(INDEX_CSV);
+  csvstream csv(source);
+  map<string, string> row;
+  csv >> row;
+  csv.build_index();
+  csv >> row;
+  ASSERT_EQUAL(row["tag"], "b");
+}
+
+TEST(index_requires_seekable_stream) {
+  istringstream source(INDEX_CSV);
+  csvstream csv(source, ',', true, true);
+  bool thrown = false;
+  try {
+    csv.build_index();
+  } catch (const csvstream_exception &) {
+    thrown = true;
+  }
+  ASSERT_TRUE(thrown);
+}
+
+TEST(index_sample_rows) {
+  string text = "n\n";
+  for (int i = 0; i < 100; ++i) {
+    text += to_string(i) + "\n";
+  }
+  istringstream source(text);
+  csvstream csv(source);
+  csv.build_index();
+
+  vector<size_t> sample = csv.index().sample(10, 42);
+  ASSERT_EQUAL(sample.size(), 10u);
+  ASSERT_TRUE(is_sorted(sample.begin(), sample.end()));
+  ASSERT_TRUE(adjacent_find(sample.begin(), sample.end()) == sample.end());
+  ASSERT_TRUE(sample == csv.index().sample(10, 42));
+  ASSERT_EQUAL(csv.index().sample(500, 1).size(), 100u);
+
+  map<string, string> row;
+  csv.seek_row(sample[3]);
+  csv >> row;
+  ASSERT_EQUAL(row["n"], to_string(sample[3]));
+}
+
+TEST(index_split_rows) {
+  istringstream source(INDEX_CSV);
+  csvstream csv(source);
+  csv.build_index();
+
+  auto ranges = csv.index().split(3);
+  ASSERT_EQUAL(ranges.size(), 3u);
+  ASSERT_EQUAL(ranges[0].first, 0u);
+  ASSERT_EQUAL(ranges[0].second, 2u);
+  ASSERT_EQUAL(ranges[1].second, 3u);
+  ASSERT_EQUAL(ranges[2].second, 4u);
+}
+
+TEST(index_persisted_next_to_file) {
+  string filename = "/tmp/csvstream_tests_index.csv";
+  {
+    ofstream fout(filename.c_str(), ios::binary | ios::trunc);
+    fout << INDEX_CSV;
+  }
+  remove((filename + ".rowidx").c_str());
+  {
+    csvstream csv(filename);
+    csv.build_index(true);
+  }
+
+  csvstream_index index;
+  ASSERT_TRUE(index.load(filename + ".rowidx", filename));
+  ASSERT_EQUAL(index.size(), 4u);
+
+  // A changed source invalidates the saved index
+  {
+    ofstream fout(filename.c_str(), ios::binary | ios::app);
+    fout << "\ne,more\n";
+  }
+  ASSERT_FALSE(index.load(filename + ".rowidx", filename));
+  csvstream csv(filename);
+  csv.build_index(true);
+  ASSERT_EQUAL(csv.index().size(), 5u);
+}
+
+TEST(paren_header_passes_through) {
+  // '(' is the first byte of the zstd magic number
+  istringstream source("(a),b\n1,2\n");
+  csvstream csv(source);
+  auto rows = read_all(csv);
+  ASSERT_EQUAL(rows.size(), 1u);
+  ASSERT_EQUAL(rows[0]["(a)"], "1");
+}
+
+TEST(paren_header_can_be_indexed) {
+  // a seekable plain stream starting with '(' is read directly, so it can
+  // still seek
+  istringstream source("(a),b\n1,2\n3,4\n");
+  csvstream csv(source);
+  csv.build_index();
+  csv.seek_row(1);
+  map<string, string> row;
+  csv >> row;
+  ASSERT_EQUAL(row["(a)"], "3");
+}
+
+#ifdef CSVSTREAM_ZLIB
+// EFFECTS return text compressed as one gzip member
+static string gzip(const string &text) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  string out(deflateBound(&zs, text.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+  zs.avail_in = text.size();
+  zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+  zs.avail_out = out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+TEST(gzip_input_matches_plain_input) {
+  string text = "tag,content\n";
+  for (int i = 0; i < 20000; ++i) {
+    text += (i % 3 ? "euchre," : "calculator,") + to_string(i) + "\n";
+  }
+  istringstream plain_source(text);
+  csvstream plain(plain_source);
+  auto expected = read_all(plain);
+
+  for (bool async : {false, true}) {
+    istringstream source(gzip(text));
+    csvstream csv(source, ',', true, async);
+    ASSERT_TRUE(read_all(csv) == expected);
+  }
+}
+
+TEST(gzip_concatenated_members) {
+  istringstream source(gzip("tag,content\na,1\n") + gzip("b,2\n"));
+  csvstream csv(source);
+  auto rows = read_all(csv);
+  ASSERT_EQUAL(rows.size(), 2u);
+  ASSERT_EQUAL(rows[1]["content"], "2");
+}
+
+TEST(gzip_truncated_input_throws) {
+  string text = "tag,content\n";
+  for (int i = 0; i < 1000; ++i) {
+    text += "a," + to_string(i * 7919) + "\n";
+  }
+  string compressed = gzip(text);
+  istringstream source(compressed.substr(0, compressed.size() / 2));
+  bool thrown = false;
+  try {
+    csvstream csv(source);
+    read_all(csv);
+  } catch (const csvstream_exception &) {
+    thrown = true;
+  }
+  ASSERT_TRUE(thrown);
+}
+#else
+TEST(gzip_unsupported_throws) {
+  istringstream source(string("\x1f\x8b\x08\x00", 4));
+  bool thrown = false;
+  try {
+    csvstream csv(source);
+  } catch (const csvstream_exception &) {
+    thrown = true;
+  }
+  ASSERT_TRUE(thrown);
+}
+#endif
+
+TEST_MAIN()
@@ -1,247 +1,598 @@
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "csvstream.hpp"
-#include <map>
-#include <set>
-#include <cmath>
+#include "csvcache.hpp"
+#include "Classifier.hpp"
+#include "HashedClassifier.hpp"
+#include "ShardedTrainer.hpp"
+#include "OutputWriter.hpp"
+#include "ParallelPredictor.hpp"
+#include "PredictionServer.hpp"
 
 using namespace std;
 
-class Classifier{
-    private:
-        // {{label, word}, number_of_posts_with_label_containing_word}
-        map<pair<string, string>, int> label_word_map;
-        map<string, int> vocabulary_map;
-        map<string, int> label_map;
-
-        double total_number_of_posts;
-
-    public:
-        // REQUIRES valid input file name
-        // EFFECTS return a set of unique whitespace delimited words
-        set<string> unique_words(const string &str) {
-            istringstream source(str);
-            set<string> words;
-            string word;
-            while (source >> word) {
-                words.insert(word);
+// Command line options
+struct Options {
+    string train_file;
+    string test_file;
+    bool debug = false;
+    bool async_io = false;
+    bool cache = false;
+    int threads = 1;
+    string save_model;
+    string load_model;
+    string update_file;
+    int sketch_kb = 0;
+    Pruning pruning;
+    int cv_folds = 0;
+    Scoring scoring = Scoring::EXACT;
+    bool scoring_given = false;
+    int prediction_cache = 0;
+    int hash_bits = 0;
+    int ngram_order = 1;
+    bool serve = false;
+    string socket_path;
+};
+
+// Suffix of binary column caches written next to CSV files by --cache
+const string CACHE_SUFFIX = ".colcache";
+
+// MODIFIES options
+// EFFECTS parse command line arguments, return false on a usage error
+bool parse_options(int argc, char* argv[], Options &options){
+    vector<string> files;
+    for (int i = 1; i < argc; ++i){
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--debug"){
+            options.debug = true;
+        } else if (arg == "--async-io"){
+            options.async_io = true;
+        } else if (arg == "--serve"){
+            options.serve = true;
+        } else if (arg == "--socket" && has_value){
+            options.socket_path = argv[++i];
+        } else if (arg == "--cache"){
+            options.cache = true;
+        } else if (arg == "--threads" && has_value){
+            options.threads = atoi(argv[++i]);
+            if (options.threads < 1){
+                return false;
+            }
+        } else if (arg == "--save-model" && has_value){
+            options.save_model = argv[++i];
+        } else if (arg == "--load-model" && has_value){
+            options.load_model = argv[++i];
+        } else if (arg == "--update" && has_value){
+            options.update_file = argv[++i];
+        } else if (arg == "--min-df" && has_value){
+            options.pruning.min_document_frequency = atoi(argv[++i]);
+        } else if (arg == "--top-k" && has_value){
+            options.pruning.top_k = max(atoi(argv[++i]), 0);
+        } else if (arg == "--top-mi" && has_value){
+            options.pruning.top_mutual_information = max(atoi(argv[++i]), 0);
+        } else if (arg == "--cv" && has_value){
+            options.cv_folds = atoi(argv[++i]);
+            if (options.cv_folds < 2){
+                return false;
+            }
+        } else if (arg == "--scoring" && has_value){
+            options.scoring_given = true;
+            string mode = argv[++i];
+            if (mode == "exact"){
+                options.scoring = Scoring::EXACT;
+            } else if (mode == "sparse"){
+                options.scoring = Scoring::SPARSE;
+            } else if (mode == "early-exit"){
+                options.scoring = Scoring::EARLY_EXIT;
+            } else if (mode == "int8"){
+                options.scoring = Scoring::INT8;
+            } else if (mode == "fp16"){
+                options.scoring = Scoring::FP16;
+            } else {
+                return false;
+            }
+        } else if (arg == "--prediction-cache" && has_value){
+            options.prediction_cache = max(atoi(argv[++i]), 0);
+        } else if (arg == "--hash-bits" && has_value){
+            options.hash_bits = atoi(argv[++i]);
+            if (options.hash_bits < 1 ||
+                options.hash_bits > HashedClassifier::MAX_BITS){
+                return false;
+            }
+        } else if (arg == "--ngrams" && has_value){
+            options.ngram_order = atoi(argv[++i]);
+            if (options.ngram_order < 1 ||
+                options.ngram_order > Tokenizer::MAX_ORDER){
+                return false;
             }
-            return words;
+        } else if (arg == "--sketch-kb" && has_value){
+            options.sketch_kb = atoi(argv[++i]);
+            if (options.sketch_kb < 1){
+                return false;
+            }
+        } else if (arg.compare(0, 2, "--") != 0){
+            files.push_back(arg);
+        } else {
+            return false;
         }
+    }
 
-        // REQUIRES str, label
-        // MODIFIES word_label_count
-        // EFFECTS insert str and label into their respective maps
-        void train_model(const string &label, const string &str){
-            total_number_of_posts++;
-            
-            set<string> words = unique_words(str);
+    // shards and cross-validation folds train with exact counts, which a
+    // memory budget rules out
+    if (options.sketch_kb > 0 && (options.threads > 1 || options.cv_folds > 0)){
+        return false;
+    }
 
-            pair<string, string> key_pair;
+    // a hashed model keeps no words to print, prune, save or update, and
+    // trains on one thread
+    if (options.hash_bits > 0 &&
+        (options.debug || options.cache || options.threads > 1 ||
+         options.sketch_kb > 0 || options.pruning.enabled() ||
+         !options.save_model.empty() || !options.load_model.empty() ||
+         !options.update_file.empty() || options.cv_folds > 0 ||
+         options.serve)){
+        return false;
+    }
 
-            for (const auto&word : words){
-                key_pair = make_pair(label, word);
-                label_word_map[key_pair]++;
+    // only hashed features count runs of several words, which a vocabulary
+    // of named words does not keep
+    if (options.ngram_order > 1 && options.hash_bits == 0){
+        return false;
+    }
 
-                vocabulary_map[word]++;
-            }
-            label_map[label]++;
+    // a loaded model replaces the training file, and cross-validation
+    // tests on the training file
+    if (!options.load_model.empty()){
+        if (options.cv_folds > 0){
+            return false;
         }
-
-        // EFFECTS return vocabulary size
-        int get_vocabulary_size(){
-            return vocabulary_map.size();
+        files.insert(files.begin(), "");
+    }
+    // a server takes its test posts as requests
+    if (!options.socket_path.empty() && !options.serve){
+        return false;
+    }
+    if (options.serve){
+        // stdout carries the responses
+        if (options.cv_folds > 0 || options.debug){
+            return false;
         }
+        files.push_back("");
+    }
+    if (options.cv_folds > 0){
+        files.push_back("");
+    }
+    if (files.size() != 2){
+        return false;
+    }
+    options.train_file = files[0];
+    options.test_file = files[1];
+    return true;
+}
 
-        // REQUIRES word
-        // EFFECTS return number of posts containing w input
-        int get_num_post_word(const string &word){
-            return vocabulary_map.find(word)->second;
-        }
+// MODIFIES out
+// EFFECTS print the label and content of every row of batch to out
+template <typename Batch>
+void print_batch(const Classifier &classifier, const Batch &batch,
+                 OutputWriter &out){
+    size_t tag_column = batch.column_index("tag");
+    size_t content_column = batch.column_index("content");
+
+    for (size_t i = 0; i < batch.size(); ++i){
+        classifier.print_label_content(batch.value(tag_column, i),
+                                       batch.value(content_column, i), out);
+    }
+}
 
-        // REQUIRES label
-        // EFFECTS return number of post with label input
-        int get_num_label(const string &label){
-            return label_map.find(label)->second;
-        }
+// MODIFIES classifier, out
+// EFFECTS train classifier on every row of batch, printing the rows to
+//         out if debug
+template <typename Batch>
+void train_batch(Classifier &classifier, const Batch &batch, bool debug,
+                 OutputWriter &out){
+    size_t tag_column = batch.column_index("tag");
+    size_t content_column = batch.column_index("content");
+
+    for (size_t i = 0; i < batch.size(); ++i){
+        string_view label = batch.value(tag_column, i);
+        string_view word = batch.value(content_column, i);
+        classifier.train_model(label, word);
 
-        // REQUIRES label
-        // EFFECTS return number of post with label input
-        int get_num_label_word(const string &label, const string &word){
-            return label_word_map.find(make_pair(label, word))->second;
+        if (debug){
+            classifier.print_label_content(label, word, out);
         }
+    }
+}
 
-        // REQUIRES label
-        // EFFECTS return log_prior_probability
-        double log_prior_prob(const string &label){
-            double n1 = get_num_label(label);
-            return log(n1/total_number_of_posts);
-        }
+// EFFECTS print read-ahead stall times of csv to cerr
+void print_readahead_stats(const string &name, const csvstream &csv){
+    csvstream_readahead_stats stats = csv.readahead_stats();
+    cerr << name << ": read " << stats.bytes_read << " bytes in "
+    << stats.buffers_filled << " buffers, parser stalled "
+    << stats.parser_stall_seconds << "s, reader stalled "
+    << stats.reader_stall_seconds << "s" << endl;
+}
 
-        // REQUIRES label
-        // EFFECTS return log_prior_likelihood
-        double log_likelihood(const string &label, const string &word){
-            if (vocabulary_map.find(word) == vocabulary_map.end()){
-                return log(1.0 / total_number_of_posts);
-            }else if ((label_word_map.find(make_pair(label, word))
-                     == label_word_map.end())){
-
-                double n1 = get_num_post_word(word);
-                return log(n1 / total_number_of_posts);
-            }else {
-                double n1 = get_num_label_word(label, word);
-                return log(n1 / label_map.find(label)->second);
-            }
-        }
+// EFFECTS print the hits and misses of prediction caches to cerr, if
+//         options enable them
+void print_cache_stats(const Options &options,
+                       const PredictionCache::Stats &stats){
+    if (options.prediction_cache == 0){
+        return;
+    }
+    cerr << "prediction cache: " << stats.hits << " hits, "
+    << stats.misses << " misses" << endl;
+}
 
-        void print_label_content(const string &label, const string &content){
-            cout << "  label = " << label <<  ", "
-            << "content = " << content << endl;
-        }
+// MODIFIES classifier, out
+// EFFECTS train classifier on the cached columns of the training file
+void train_from_cache(Classifier &classifier, const Options &options,
+                      OutputWriter &out){
+    csvcache train_data(options.train_file,
+                        options.train_file + CACHE_SUFFIX,
+                        options.async_io);
+    if (options.threads == 1){
+        train_batch(classifier, train_data, options.debug, out);
+        return;
+    }
 
-        void print_training_posts(){
-            cout << "trained on " << total_number_of_posts << " examples" << endl;
-        }
+    ShardedTrainer trainer(options.threads);
+    trainer.start(train_data);
+    if (options.debug){
+        print_batch(classifier, train_data, out);
+    }
+    trainer.merge_into(classifier);
+}
 
-        void print_vocabulary_size(){
-            cout << "vocabulary size = " << get_vocabulary_size() << endl;
-        }
+// MODIFIES classifier, out
+// EFFECTS train classifier on the training file, parsing it batch by batch
+void train_from_stream(Classifier &classifier, const Options &options,
+                       OutputWriter &out){
+    csvstream csv_train_in(options.train_file, ',', true, options.async_io);
 
-        void print_classes(){
-            cout << "classes:" << endl;
-            for (auto &label: label_map){
-                cout << "  " << label.first << ", " << label.second
-                << " examples, log-prior = " 
-                << log_prior_prob(label.first)
-                << endl;
-            }
+    if (options.threads == 1){
+        csvstream_batch batch;
+        while(csv_train_in.read_batch(batch, BATCH_SIZE)){
+            train_batch(classifier, batch, options.debug, out);
         }
-
-        void print_classifier_parameters(){
-            cout << "classifier parameters:" << endl;
-            for (auto &label_word: label_word_map){
-                string label = label_word.first.first;
-                string word = label_word.first.second;
-                int count = label_word.second;
-
-                cout << "  " << label << ":"
-                << word << ", count = " << count
-                << ", log-likelihood = " << log_likelihood(label, word)
-                << endl;
+    } else {
+        // workers train on one batch while the next one is parsed
+        ShardedTrainer trainer(options.threads);
+        csvstream_batch batches[2];
+        int current = 0;
+        csv_train_in.read_batch(batches[current], BATCH_SIZE);
+        while (batches[current].size() > 0){
+            trainer.start(batches[current]);
+            if (options.debug){
+                print_batch(classifier, batches[current], out);
             }
+            csv_train_in.read_batch(batches[1 - current], BATCH_SIZE);
+            trainer.wait();
+            current = 1 - current;
         }
+        trainer.merge_into(classifier);
+    }
 
-        pair<string, double> compute_most_probable_tag(string &content){
-            map<string, double> probability_of_tag_map;
-            set<string> words = unique_words(content);
-
-            for (auto &label : label_map){
-                double prob_of_tag = log_prior_prob(label.first);
-                for (auto &word : words){
-                    prob_of_tag += log_likelihood(label.first, word);
-                }
-                probability_of_tag_map.insert(
-                    make_pair(label.first, prob_of_tag)
-                    );
-            }
-
-            string first_tag = probability_of_tag_map.begin()->first;
-            double first_log_prob = probability_of_tag_map.begin()->second;
+    if (options.async_io){
+        print_readahead_stats(options.train_file, csv_train_in);
+    }
+}
 
-            pair<string, double> highest_probability = make_pair(first_tag, first_log_prob);
+// MODIFIES classifier, out
+// EFFECTS add the posts of the update file to classifier
+void apply_update(Classifier &classifier, const Options &options,
+                  OutputWriter &out){
+    if (options.debug){
+        out << "update data:" << '\n';
+    }
+    csvstream csv_update_in(options.update_file, ',', true, options.async_io);
+    csvstream_batch batch;
+    while (csv_update_in.read_batch(batch, BATCH_SIZE)){
+        classifier.update_batch(batch);
+        if (options.debug){
+            print_batch(classifier, batch, out);
+        }
+    }
+}
 
-            for (auto &prob : probability_of_tag_map){
-                if (prob.second > highest_probability.second){
-                    highest_probability = make_pair(prob.first, prob.second);
+// MODIFIES correct
+// EFFECTS test a classifier trained on every fold of rows but one on that
+//         fold, for each fold at once. fold_of[i] is the fold of row i.
+template <typename Batch>
+void test_folds(const Classifier &all, const vector<Classifier> &folds,
+                const Batch &rows, const vector<int> &fold_of,
+                vector<int> &correct){
+    size_t tag_column = rows.column_index("tag");
+    size_t content_column = rows.column_index("content");
+    vector<thread> workers;
+    for (int fold = 0; fold < int(folds.size()); ++fold){
+        workers.emplace_back([&, fold](){
+            Classifier rest = all.without(folds[fold]);
+            for (size_t i = 0; i < rows.size(); ++i){
+                if (fold_of[i] == fold &&
+                    rest.compute_most_probable_tag(
+                        rows.value(content_column, i)).first ==
+                    rows.value(tag_column, i)){
+                    correct[fold]++;
                 }
             }
+        });
+    }
+    for (auto &worker : workers){
+        worker.join();
+    }
+}
 
-            return highest_probability;
-        }
-
-        void predict_test_data(csvstream &csv_test_in){
-            pair<string, double> highest_prob_tag;
-
-            int number_predicted_correct = 0;
-            int number_test_data = 0;
-            map<string, string> row;
+// MODIFIES out
+// EFFECTS print the accuracy of k-fold cross-validation on rows to out.
+//         Every row is counted once into its fold, the folds are merged
+//         into one classifier, and each fold is tested on that classifier
+//         less the fold's own counts.
+template <typename Batch>
+void cross_validate(const Batch &rows, const Options &options,
+                    OutputWriter &out){
+    size_t tag_column = rows.column_index("tag");
+    size_t content_column = rows.column_index("content");
+    int k = options.cv_folds;
+    vector<Classifier> folds(k);
+    vector<int> fold_of(rows.size());
+    vector<int> totals(k, 0);
+    for (size_t i = 0; i < rows.size(); ++i){
+        fold_of[i] = i % k;
+        totals[fold_of[i]]++;
+        folds[fold_of[i]].train_model(rows.value(tag_column, i),
+                                      rows.value(content_column, i));
+    }
 
-            cout << "test data:" << endl;
+    Classifier all;
+    for (auto &fold : folds){
+        all.merge(fold);
+    }
+    all.set_scoring(options.scoring);
+    all.set_prediction_cache(options.prediction_cache);
+    if (options.pruning.enabled()){
+        all.set_pruning(options.pruning);
+    }
 
-            while(csv_test_in >> row){
-                number_test_data++;
+    vector<int> correct(k, 0);
+    test_folds(all, folds, rows, fold_of, correct);
+    int number_correct = 0;
+    for (int fold = 0; fold < k; ++fold){
+        out << "fold " << fold + 1 << " ";
+        all.print_performance(correct[fold], totals[fold], out);
+        number_correct += correct[fold];
+    }
+    out << "cross-validation ";
+    all.print_performance(number_correct, rows.size(), out);
+}
 
-                string content = row["content"];
-                highest_prob_tag = compute_most_probable_tag(content);
+// MODIFIES out
+// EFFECTS print k-fold cross-validation accuracy on the training file to
+//         out
+void cross_validate(const Options &options, OutputWriter &out){
+    if (options.cache){
+        csvcache rows(options.train_file,
+                      options.train_file + CACHE_SUFFIX,
+                      options.async_io);
+        cross_validate(rows, options, out);
+    } else {
+        csvstream csv(options.train_file, ',', true, options.async_io);
+        csvstream_batch rows;
+        csv.read_batch(rows, SIZE_MAX);
+        cross_validate(rows, options, out);
+    }
+}
 
-                cout << "  correct = " << row["tag"] <<  ", "
-                << "predicted = " << highest_prob_tag.first << 
-                ", log-probability score = " << highest_prob_tag.second
-                << endl;
+// MODIFIES classifier, out
+// EFFECTS predict and print every row of batches read by next_batch to
+//         out, on options.threads threads, then print the accuracy
+template <typename Batch, typename NextBatch>
+void predict_in_parallel(Classifier &classifier, const Options &options,
+                         NextBatch next_batch, OutputWriter &out){
+    out << "test data:" << '\n';
+    ParallelPredictor<Batch> predictor(classifier, options.threads, out);
+    while (std::shared_ptr<const Batch> batch = next_batch()){
+        predictor.add(batch);
+    }
+    predictor.finish();
+    classifier.print_performance(predictor.number_correct(),
+                                 predictor.number_predicted(), out);
+    print_cache_stats(options, predictor.cache_stats());
+}
 
-                cout << "  content = " << content << endl << endl;
+// MODIFIES classifier, out
+// EFFECTS predict and print every row of the test file to out, then print
+//         the accuracy
+void predict_test_file(Classifier &classifier, const Options &options,
+                       OutputWriter &out){
+    if (options.cache){
+        auto test_data = make_shared<const csvcache>(
+            options.test_file, options.test_file + CACHE_SUFFIX,
+            options.async_io);
+        if (options.threads == 1){
+            classifier.predict_test_data(*test_data, out);
+            print_cache_stats(options, classifier.prediction_cache_stats());
+            return;
+        }
+        predict_in_parallel<csvcache>(classifier, options, [&test_data](){
+            return std::exchange(test_data, nullptr);
+        }, out);
+        return;
+    }
 
-                if (row["tag"] == highest_prob_tag.first){
-                    number_predicted_correct++;
-                }
+    csvstream csv_test_in(options.test_file, ',', true, options.async_io);
+    if (options.threads == 1){
+        classifier.predict_test_data(csv_test_in, out);
+        print_cache_stats(options, classifier.prediction_cache_stats());
+    } else {
+        // a new batch each time, kept until its rows are printed
+        predict_in_parallel<csvstream_batch>(classifier, options, [&](){
+            auto batch = make_shared<csvstream_batch>();
+            if (!csv_test_in.read_batch(*batch, BATCH_SIZE)){
+                batch.reset();
             }
+            return std::shared_ptr<const csvstream_batch>(batch);
+        }, out);
+    }
+    if (options.async_io){
+        print_readahead_stats(options.test_file, csv_test_in);
+    }
+}
 
-            cout << "performance: " << number_predicted_correct << " / "
-            << number_test_data << " posts predicted correctly" << endl;
+// MODIFIES classifier, out
+// EFFECTS load or train classifier, then update and prune it and set how
+//         it scores, as options say. Debug output goes to out.
+void build_classifier(Classifier &classifier, const Options &options,
+                      OutputWriter &out){
+    if (!options.load_model.empty()){
+        classifier.load_model(options.load_model);
+    } else {
+        if (options.debug){
+            out << "training data:" << '\n';
         }
+        if (options.cache){
+            train_from_cache(classifier, options, out);
+        } else {
+            train_from_stream(classifier, options, out);
+        }
+    }
 
-};
-
+    if (!options.update_file.empty()){
+        apply_update(classifier, options, out);
+    }
 
-int main(int argc, char* argv[]) {
-    cout.precision(3);
-    bool debug = false;
+    if (options.pruning.enabled()){
+        classifier.set_pruning(options.pruning);
+    }
+    // a loaded quantized model keeps scoring from its own rows unless
+    // another mode is asked for
+    if (options.scoring_given){
+        classifier.set_scoring(options.scoring);
+    }
+    classifier.set_prediction_cache(options.prediction_cache);
+}
 
-    if (argc != 3 && argc != 4){
-        cout << "Usage: main.exe TRAIN_FILE TEST_FILE [--debug]" << endl;
-        return 1;
-    } else if (argc == 4){
-        debug = true;
+// MODIFIES out
+// EFFECTS train a classifier on hashed words, or runs of words, of the
+//         training file, then predict and print every row of the test file
+//         to out, and the accuracy
+void predict_hashed(const Options &options, OutputWriter &out){
+    HashedClassifier classifier(options.hash_bits, options.ngram_order);
+    csvstream csv_train_in(options.train_file, ',', true, options.async_io);
+    csvstream_batch batch;
+    while (csv_train_in.read_batch(batch, BATCH_SIZE)){
+        classifier.train_batch(batch);
+    }
+    classifier.print_training_posts(out);
+    out << '\n';
+
+    csvstream csv_test_in(options.test_file, ',', true, options.async_io);
+    classifier.predict_test_data(csv_test_in, out);
+    out.flush();
+    cerr << "hashed model: " << classifier.num_buckets() << " buckets, "
+    << classifier.memory_bytes() << " bytes" << endl;
+}
 
-        string debug = argv[3];
-        if (debug != "--debug"){
-            cout << "Usage: main.exe TRAIN_FILE TEST_FILE [--debug]" << endl;
-            return 1;
+// EFFECTS answer prediction requests on stdin, or on options.socket_path,
+//         until they end. The classifier is built again in the background
+//         and swapped in on SIGHUP or a reload request, see
+//         PredictionServer.
+void serve(const Options &options){
+    ModelHandle models([&options](){
+        auto classifier = options.sketch_kb > 0
+            ? make_unique<Classifier>(size_t(options.sketch_kb) * 1024)
+            : make_unique<Classifier>();
+        // --serve excludes --debug, so nothing is printed
+        OutputWriter out(cout);
+        build_classifier(*classifier, options, out);
+        if (!options.save_model.empty()){
+            classifier->save_model(options.save_model);
         }
+        return classifier;
+    });
+    models.reload_on_signal(SIGHUP);
+
+    PredictionServer server(models);
+    if (options.socket_path.empty()){
+        server.serve_stream(STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        server.serve_socket(options.socket_path);
     }
-    
-    string train_file = argv[1];
-    csvstream csv_train_in(train_file);
-
-    map<string, string> row;
-    Classifier classifier;
+}
 
-    if (debug){
-        cout << "training data:" << endl;
+int main(int argc, char* argv[]) {
+    Options options;
+
+    if (!parse_options(argc, argv, options)){
+        cout << "Usage: main.exe TRAIN_FILE TEST_FILE [--debug] [--async-io] "
+        << "[--cache] [--threads N] [--sketch-kb N] [--update FILE] "
+        << "[--min-df N] [--top-k N] [--top-mi N] [--save-model FILE] "
+        << "[--scoring MODE] [--prediction-cache N]" << endl
+        << "       main.exe --load-model FILE TEST_FILE [--debug] "
+        << "[--async-io] [--cache] [--threads N] [--update FILE] "
+        << "[--min-df N] [--top-k N] [--top-mi N] [--save-model FILE] "
+        << "[--scoring MODE] [--prediction-cache N]" << endl
+        << "       main.exe TRAIN_FILE --serve [--socket PATH] [options]"
+        << endl
+        << "       main.exe --load-model FILE --serve [--socket PATH] "
+        << "[options]" << endl
+        << "       main.exe TRAIN_FILE TEST_FILE --hash-bits B [--ngrams N] "
+        << "[--async-io]" << endl
+        << "       main.exe TRAIN_FILE --cv K [--async-io] [--cache] "
+        << "[--min-df N] [--top-k N] [--top-mi N] [--scoring MODE]" << endl
+        << "MODE is exact (default), sparse, early-exit, int8 or fp16"
+        << endl;
+        return 1;
+    }
+    // all results go through one buffer, written out when it fills up and
+    // when main returns
+    OutputWriter out(cout);
+    if (options.cv_folds > 0){
+        cross_validate(options, out);
+        return 0;
     }
 
-    while(csv_train_in >> row){
-        string label = row["tag"];
-        string word = row["content"];
-        classifier.train_model(label, word);
+    if (options.serve){
+        serve(options);
+        return 0;
+    }
+    if (options.hash_bits > 0){
+        predict_hashed(options, out);
+        return 0;
+    }
 
-        if (debug){
-            classifier.print_label_content(label, word); 
-        }
+    Classifier classifier = options.sketch_kb > 0
+        ? Classifier(size_t(options.sketch_kb) * 1024) : Classifier();
+    build_classifier(classifier, options, out);
+    if (!options.save_model.empty()){
+        classifier.save_model(options.save_model);
     }
+    bool debug = options.debug;
+    classifier.print_training_posts(out);
 
-    classifier.print_training_posts();
+    if (!debug){
+        out << '\n';
+    }
 
     if (debug){
-        classifier.print_vocabulary_size();
-        cout << endl;
-        classifier.print_classes();
-        classifier.print_classifier_parameters();
-        cout << endl;
+        classifier.print_vocabulary_size(out);
+        out << '\n';
+        classifier.print_classes(out);
+        classifier.print_classifier_parameters(out);
+        out << '\n';
     }
 
-    string test_file = argv[2];
-    csvstream csv_test_in(test_file);
-    classifier.predict_test_data(csv_test_in);
-
+    predict_test_file(classifier, options, out);
+    if (options.sketch_kb > 0){
+        out.flush();
+        cerr << "sketched counts: " << classifier.counts_memory_bytes()
+        << " bytes" << endl;
+    }
 }
@@ -0,0 +1,25 @@
+#ifndef TEST_MODEL_HPP
+#define TEST_MODEL_HPP
+/* test_model.hpp
+ *
+ * A small model's counts shared by the model file and quantized row tests.
+ */
+
+#include "ModelFile.hpp"
+
+// EFFECTS return a model of 4 posts: two "calculator" posts with "stack",
+//         and two "euchre" posts with "card", one of them also with "stack"
+static inline ModelData small_model() {
+  ModelData data;
+  data.total_posts = 4;
+  data.label_names = {"calculator", "euchre"};
+  data.label_counts = {2, 2};
+  data.word_names = {"card", "stack"};
+  data.word_counts = {2, 3};
+  data.entry_starts = {0, 1, 3};
+  data.entry_labels = {1, 0, 1};
+  data.entry_counts = {2, 2, 1};
+  return data;
+}
+
+#endif // TEST_MODEL_HPP
@@ -0,0 +1,34 @@
+#ifndef TEST_POSTS_HPP
+#define TEST_POSTS_HPP
+/* test_posts.hpp
+ *
+ * Training posts shared by the classifier, model handle and server tests.
+ */
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Classifier.hpp"
+
+static const std::vector<std::pair<std::string, std::string>> POSTS = {
+  {"euchre", "can the upcard ever be the left bower"},
+  {"euchre", "when would the dealer ever prefer a card to the upcard"},
+  {"calculator", "how to assert rational invariants"},
+  {"euchre", "bob played the same card twice is he cheating"},
+  {"calculator", "does stack need its own big three"},
+  {"image", "how to rotate the image"},
+};
+
+// EFFECTS return a classifier trained on POSTS, with every label prefixed
+//         by prefix
+static inline std::unique_ptr<Classifier> trained(
+    const std::string &prefix = "") {
+  auto classifier = std::make_unique<Classifier>();
+  for (auto &post : POSTS) {
+    classifier->train_model(prefix + post.first, post.second);
+  }
+  return classifier;
+}
+
+#endif // TEST_POSTS_HPP